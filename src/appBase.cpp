@@ -12,19 +12,22 @@
 #include "stb_image_write.h"
 
 #include <algorithm> // transform
+#include <cctype> // isdigit
 #include <cmath> // floor
+#include <filesystem>
 
 
 namespace poncaplot{
-    void write_image(int w, int h, float *texture, const std::string &filename) {
-        {
-            auto buffer = new char[w * h * 4];
+    namespace {
+        /// Convert a linear RGBA float texture to 8 bits sRGB
+        void to_srgb8(int w, int h, const float *texture, std::vector<char> &buffer) {
+            buffer.resize(size_t(w) * h * 4);
 
             // Converts a linear value in the range [0, 1] to an sRGB value in
             // the range [0, 255].
             // Source : https://github.com/PetterS/opencv_srgb_gamma/blob/master/srgb.h
             std::transform(texture, texture + w * h * 4,
-                           buffer,
+                           buffer.data(),
                            [](float linear) -> char {
                                float srgb;
                                if (linear <= 0.0031308f) {
@@ -34,10 +37,63 @@ namespace poncaplot{
                                }
                                return srgb * 255.f;
                            });
-            stbi_write_png(filename.c_str(), w, h,
-                           4, buffer, w * 4);
-            stbi_image_free(buffer);
         }
-    };
-}
+    }
+
+    bool write_image(int w, int h, float *texture, const std::string &filename) {
+        std::vector<char> buffer;
+        return write_image(w, h, texture, filename, buffer);
+    }
+
+    bool write_image(int w, int h, const float *texture, const std::string &filename, std::vector<char> &buffer) {
+        to_srgb8(w, h, texture, buffer);
+        return stbi_write_png(filename.c_str(), w, h,
+                              4, buffer.data(), w * 4) != 0;
+    }
+
+    bool encode_image(int w, int h, const float *texture, std::vector<char> &png, std::vector<char> &buffer) {
+        to_srgb8(w, h, texture, buffer);
+        return stbi_write_png_to_func([](void *context, void *data, int size) {
+                                          auto *out = static_cast<std::vector<char> *>(context);
+                                          out->insert(out->end(), static_cast<char *>(data),
+                                                      static_cast<char *>(data) + size);
+                                      }, &png, w, h, 4, buffer.data(), w * 4) != 0;
+    }
 
+    std::string formatFramePath(const std::string &pattern, size_t frame) {
+        // the pattern comes from the user: substitute the number by hand instead of passing it to printf
+        const std::string number = std::to_string(frame);
+        const auto padded = [&number](size_t width, char fill) {
+            return std::string(number.size() < width ? width - number.size() : 0, fill) + number;
+        };
+        std::string path;
+        bool substituted = false;
+        for (size_t k = 0; k < pattern.size(); ++k) {
+            if (pattern[k] != '%') {
+                path += pattern[k];
+                continue;
+            }
+            if (k + 1 < pattern.size() && pattern[k + 1] == '%') {
+                path += '%';
+                ++k;
+                continue;
+            }
+            // %[0][width]d, with at most 2 digits of width
+            size_t e = k + 1;
+            while (e < pattern.size() && e < k + 3 && std::isdigit(static_cast<unsigned char>(pattern[e]))) ++e;
+            if (substituted || e == pattern.size() || pattern[e] != 'd') {
+                path += '%'; // not a frame number conversion: kept as is
+                continue;
+            }
+            const std::string flags = pattern.substr(k + 1, e - k - 1);
+            path += padded(flags.empty() ? 0 : std::stoul(flags), flags.size() > 1 && flags[0] == '0' ? '0' : ' ');
+            substituted = true;
+            k = e;
+        }
+        if (!substituted) {
+            const std::filesystem::path p(path);
+            path = (p.parent_path() / (p.stem().string() + "_" + padded(4, '0') + p.extension().string())).string();
+        }
+        return path;
+    }
+}
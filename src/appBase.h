@@ -1,7 +1,22 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 namespace poncaplot {
-    void write_image(int w, int h, float *texture, const std::string &filename);
+    /// Save a linear RGBA float texture as a PNG file
+    /// \return false if the file cannot be written
+    bool write_image(int w, int h, float *texture, const std::string &filename);
+
+    /// Same as above, using buffer as conversion storage: reuse it between calls to avoid reallocations
+    bool write_image(int w, int h, const float *texture, const std::string &filename, std::vector<char> &buffer);
+
+    /// Encode a texture as PNG in memory, appended to png
+    /// \return false if the encoding failed
+    bool encode_image(int w, int h, const float *texture, std::vector<char> &png, std::vector<char> &buffer);
+
+    /// Build the output path of a frame from a printf-like pattern (e.g. out_%04d.png). The first %[0][width]d is
+    /// replaced by the frame number and %% by %, other characters are kept as is. If the pattern has no frame number
+    /// conversion, the frame number is added before the extension (e.g. out_0012.png)
+    std::string formatFramePath(const std::string &pattern, size_t frame);
 }
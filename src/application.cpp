@@ -4,9 +4,10 @@
 #include "myview.h"
 #include "dataManager.h"
 #include "drawingPass.h"
+#include "scaleSweep.h"
+#include "slicing.h"
+#include "tileScheduler.h"
 
-#include <sstream>
-#include <iomanip>
 
 #include <nanogui/window.h>
 #include <nanogui/colorpicker.h>
@@ -15,17 +16,13 @@
 #include <nanogui/layout.h>
 #include <nanogui/slider.h>
 #include <nanogui/checkbox.h>
+#include <nanogui/progressbar.h>
 
 #include <nanogui/opengl.h> // GLFW_KEY_ESCAPE and others
 
-using namespace nanogui;
-
-#define CONFIG_PONCA_FIT_INTERFACE(FitWidget,fit,name)                                 \
-        {                                                                              \
-        FitWidget = new nanogui::Widget(window);                                       \
-        FitWidget->set_layout(new GroupLayout());                                      \
-        }
+#include <algorithm> // clamp, copy_n, fill, min, max
 
+using namespace nanogui;
 
 namespace poncaplot {
     const int tex_width = 500;
@@ -34,14 +31,18 @@ namespace poncaplot {
     PoncaPlotApplication::PoncaPlotApplication(DataManager *mgr) :
             Screen(Vector2i(1200, 1024), "PoncaPlot"), m_dataMgr(mgr) {
 
-        m_dataMgr->setKdTreePostUpdateFunction([this]() { this->renderPasses(); });
+        m_dataMgr->setKdTreePostUpdateFunction([this]() {
+            m_dataMgr->prepareSpatialIndex();
+            this->renderPasses();
+        });
 
         // force creation of all supported DrawingPasses
         for (int i = 0; i != m_dataMgr->nbSupportedDrawingPasses; ++i)
             m_dataMgr->getDrawingPass(i);
 
         m_passes[0] = new FillPass({1, 1, 1, 1});
-        m_passes[1] = m_dataMgr->getDrawingPass("MLS - Oriented Sphere");
+        m_fitPassId = DataManager::getDrawingPassIndex("MLS - Oriented Sphere");
+        m_passes[1] = m_dataMgr->getDrawingPass(m_fitPassId);
         m_passes[2] = new ColorMap({1, 1, 1, 1});
         m_passes[3] = new DisplayPoint({0, 0, 0, 1});
 
@@ -102,6 +103,15 @@ namespace poncaplot {
                 m_dataMgr->fitPointCloudToRange({tex_width - bordersize, tex_height - bordersize},
                                                 {bordersize, bordersize});
             });
+            b = new Button(tools, "Reorder points");
+            b->set_tooltip("Store the points in kd-tree leaf order, for faster fits. Point ids are not changed");
+            b->set_callback([&] {
+                m_image_view->clearSelection(); // selections are storage indices
+                m_dataMgr->reorderPoints();
+                const int value = m_dataMgr->storageId(pointIdSelector->value());
+                m_dataMgr->processPasses<OnePointFitFieldBase>([value](OnePointFitFieldBase* p){ p->pointId = value; });
+                renderPasses();
+            });
             b = new Button(tools, "Save image");
             b->set_callback([&] {
                 auto path = file_dialog(this, nanogui::FileDialogType::Save,
@@ -113,7 +123,8 @@ namespace poncaplot {
 
                 size_t factor = 2;
                 float *texture = new float[factor * tex_width * tex_height * 4];
-                renderPassesInternal(factor, texture);
+                FieldBuffer fields;
+                renderPassesInternal(factor, texture, fields, false);
                 write_image(tex_width*factor, tex_height*factor, texture, path[0]);
                 delete [] (texture);
             });
@@ -125,24 +136,53 @@ namespace poncaplot {
                     std::cerr << "Save sequence (scale) error : Received an empty file name" << std::endl; return;
                 }
                 std::cout << "Save sequence to: " << path[0] << std::endl;
+                startScaleSweepExport(path[0]);
+            });
+        }
 
-                size_t factor = 2;
-                float *texture = new float[factor * tex_width * tex_height * 4];
-                auto prev = scaleSlider->value();
-                int start {int(scaleSlider->range().first)};
-                int end   {int(scaleSlider->range().second)};
-                int length = end-start;
-                for (int i = 0; i < length; ++i)
-                {
-                    scaleSlider->callback()(float(start+i));
-                    std::ostringstream oss;
-                    oss << path[0] << std::setfill('0') << std::setw(4) << i << ".png";
-                    renderPassesInternal(factor, texture);
-                    write_image(tex_width*factor, tex_height*factor, texture, oss.str());
+        // 3D slicing
+        {
+            new nanogui::Label(window, "3D Slicing", "sans-bold");
+            auto *tools = new Widget(window);
+            tools->set_layout(new BoxLayout(Orientation::Vertical,
+                                            Alignment::Middle, 0, 6));
+            auto *b = new Button(tools, "Open 3D point cloud");
+            b->set_tooltip("Render the fit on a plane moving through a 3D cloud (MLS fits only)");
+            b->set_callback([&] {
+                auto path = file_dialog( this, nanogui::FileDialogType::Open,
+                        {{"txt", "Text file x y z [nx ny nz]"},
+                         {"bin", "Binary float32 x y z nx ny nz"}});
+                if (path.empty() || path[0].empty()) {
+                    std::cerr << "Open 3D point cloud error : Received an empty file name" << std::endl; return;
                 }
-                scaleSlider->set_value(prev);
-                scaleSlider->callback()(prev);
-                delete [] (texture);
+                auto cloud = std::make_unique<PointCloud3>();
+                if (!cloud->load(path[0])) {
+                    std::cerr << "Cannot load " << path[0] << std::endl; return;
+                }
+                const int bordersize = 20;
+                cloud->fitToSize(float(std::min(tex_width, tex_height) - 2 * bordersize));
+                m_cloud3 = std::move(cloud);
+                renderPasses();
+            });
+            b = new Button(tools, "Close 3D point cloud");
+            b->set_callback([&] {
+                m_cloud3.reset();
+                renderPasses();
+            });
+            new nanogui::Label(tools, "Plane normal");
+            auto axisCombo = new nanogui::ComboBox(tools, {"x", "y", "z"});
+            axisCombo->set_selected_index(m_sliceAxis);
+            axisCombo->set_callback([this](int id) {
+                m_sliceAxis = id;
+                if (m_cloud3) renderPasses();
+            });
+            new nanogui::Label(tools, "Plane offset");
+            auto slider = new Slider(tools);
+            slider->set_range({-0.5f * float(tex_width), 0.5f * float(tex_width)});
+            slider->set_value(m_sliceOffset);
+            slider->set_callback([&](float value) {
+                m_sliceOffset = value;
+                if (m_cloud3) renderPasses();
             });
         }
 
@@ -153,14 +193,14 @@ namespace poncaplot {
 
         new nanogui::Label(window, "Select Fit Type", "sans-bold");
 
-        std::vector<std::string> names;
-        names.resize(m_dataMgr->nbSupportedDrawingPasses);
-        for (const auto &p: m_dataMgr->supportedDrawingPasses)
-            names[p.second] = p.first;
+        const std::vector<std::string> names (m_dataMgr->supportedDrawingPasses.begin(),
+                                              m_dataMgr->supportedDrawingPasses.end());
+        const int defaultPassId = int(m_fitPassId);
 
         auto combo = new nanogui::ComboBox(window, names);
-        combo->set_selected_index(3);
+        combo->set_selected_index(defaultPassId);
         combo->set_callback([this](int id) {
+            m_fitPassId = size_t(id);
             m_passes[1] = m_dataMgr->getDrawingPass(id);
             buildPassInterface(id);
             renderPasses();
@@ -189,62 +229,79 @@ namespace poncaplot {
             new nanogui::Label(distanceFieldWidget, "no parameter available");
         }
 
-        passPlaneFit = dynamic_cast<BaseFitField *>(m_dataMgr->getDrawingPass("MLS - Plane"));
-        passSphereFit = dynamic_cast<BaseFitField *>(m_dataMgr->getDrawingPass("MLS - Sphere"));
-        passOrientedSphereFit = dynamic_cast<BaseFitField *>(m_dataMgr->getDrawingPass("MLS - Oriented Sphere"));
-        passUnorientedSphereFit = dynamic_cast<BaseFitField *>(m_dataMgr->getDrawingPass("MLS - Unoriented Sphere"));
-        passOnePlaneFit = dynamic_cast<BaseFitField *>(m_dataMgr->getDrawingPass("One Fit - Plane"));
-        passOneSphereFit = dynamic_cast<BaseFitField *>(m_dataMgr->getDrawingPass("One Fit - Sphere"));
-        passOneOrientedSphereFit = dynamic_cast<BaseFitField *>(m_dataMgr->getDrawingPass("One Fit - Oriented Sphere"));
-        passScaleView = dynamic_cast<BaseFitField *>(m_dataMgr->getDrawingPass("One Point - Scale"));
-
         {
             genericFitWidget = new nanogui::Widget(window);
             genericFitWidget->set_layout(new GroupLayout());
             new nanogui::Label(genericFitWidget, "Local Fitting", "sans-bold");
+            const FitParameters defaultParams;
             auto trajState = new CheckBox(genericFitWidget, "Display Trajectories");
-            trajState->set_checked(passPlaneFit->drawingParams.renderTrajectories); // init with plane, but sync with current.
+            trajState->set_checked(DrawingParameters().renderTrajectories);
             trajState->set_callback([&](bool state){
-                passPlaneFit->drawingParams.renderTrajectories = state;
-                passSphereFit->drawingParams.renderTrajectories = state;
-                passOrientedSphereFit->drawingParams.renderTrajectories = state;
-                passUnorientedSphereFit->drawingParams.renderTrajectories = state;
-                passOnePlaneFit->drawingParams.renderTrajectories = state;
-                passOneSphereFit->drawingParams.renderTrajectories = state;
-                passOneOrientedSphereFit->drawingParams.renderTrajectories = state;
+                m_dataMgr->processPasses<BaseFitField>([state](BaseFitField* p){
+                    p->drawingParams.renderTrajectories = state;
+                });
+                renderPasses();
+            });
+            auto gridState = new CheckBox(genericFitWidget, "Use uniform grid");
+            gridState->set_checked(m_dataMgr->getSpatialIndex() == DataManager::UNIFORM_GRID);
+            gridState->set_callback([&](bool state){
+                m_dataMgr->setSpatialIndex(state ? DataManager::UNIFORM_GRID : DataManager::KDTREE);
+                m_dataMgr->prepareSpatialIndex();
                 renderPasses();
             });
             new nanogui::Label(genericFitWidget, "Scale");
             scaleSlider = new Slider(genericFitWidget);
-            scaleSlider->set_value(passPlaneFit->params.m_scale); // init with plane, but sync with current.
+            scaleSlider->set_value(defaultParams.m_scale);
             scaleSlider->set_range({10, 750});
             scaleSlider->set_callback([&](float value) {
-                passPlaneFit->params.m_scale = value;
-                passSphereFit->params.m_scale = value;
-                passOrientedSphereFit->params.m_scale = value;
-                passUnorientedSphereFit->params.m_scale = value;
-                passOnePlaneFit->params.m_scale = value;
-                passOneSphereFit->params.m_scale = value;
-                passOneOrientedSphereFit->params.m_scale = value;
-                passScaleView->params.m_scale = value;
+                m_dataMgr->processPasses<BaseFitField>([value](BaseFitField* p){ p->params.m_scale = value; });
                 renderPasses();
             });
+            // the grid supports any radius: match its cell size to the scale once the slider is released only
+            scaleSlider->set_final_callback([&](float value) {
+                m_dataMgr->setGridCellSize(value);
+                if (m_dataMgr->getSpatialIndex() == DataManager::UNIFORM_GRID) {
+                    m_dataMgr->prepareSpatialIndex();
+                    renderPasses();
+                }
+            });
 
             new Label(genericFitWidget, "MLS Iterations :", "sans-bold");
-            auto int_box = new IntBox<int>(genericFitWidget, passPlaneFit->params.m_iter);
+            auto int_box = new IntBox<int>(genericFitWidget, defaultParams.m_iter);
             int_box->set_editable(true);
             int_box->set_spinnable(true);
             int_box->set_min_value(1);
             int_box->set_max_value(10);
             int_box->set_value_increment(1);
             int_box->set_callback([&](int value) {
-                passPlaneFit->params.m_iter = value;
-                passSphereFit->params.m_iter = value;
-                passOrientedSphereFit->params.m_iter = value;
-                passUnorientedSphereFit->params.m_iter = value;
-                passOnePlaneFit->params.m_iter = value;
-                passOneSphereFit->params.m_iter = value;
-                passOneOrientedSphereFit->params.m_iter = value;
+                m_dataMgr->processPasses<BaseFitField>([value](BaseFitField* p){ p->params.m_iter = value; });
+                renderPasses();
+            });
+
+            new Label(genericFitWidget, "Threads (0: all cores) :", "sans-bold");
+            auto threads_box = new IntBox<int>(genericFitWidget, m_nbThreads);
+            threads_box->set_editable(true);
+            threads_box->set_spinnable(true);
+            threads_box->set_min_value(0);
+            threads_box->set_max_value(256);
+            threads_box->set_value_increment(1);
+            threads_box->set_callback([&](int value) {
+                m_nbThreads = value;
+                renderPasses();
+            });
+            new nanogui::Label(genericFitWidget, "Tile schedule");
+            auto scheduleCombo = new nanogui::ComboBox(genericFitWidget,
+                    std::vector<std::string>(RenderingContext::scheduleNames.begin(),
+                                             RenderingContext::scheduleNames.end()));
+            scheduleCombo->set_selected_index(m_schedule);
+            scheduleCombo->set_callback([this](int id) {
+                m_schedule = RenderingContext::Schedule(id);
+                renderPasses();
+            });
+            auto exactBox = new CheckBox(genericFitWidget, "Exact fits (no level of detail)");
+            exactBox->set_checked(m_exactFits);
+            exactBox->set_callback([this](bool value) {
+                m_exactFits = value;
                 renderPasses();
             });
         }
@@ -260,37 +317,82 @@ namespace poncaplot {
             pointIdSelector->set_min_value(0);
             pointIdSelector->set_max_value(m_dataMgr->getPointContainer().size());
             pointIdSelector->set_value_increment(1);
-            pointIdSelector->set_callback([&](int value) {
-                dynamic_cast<OnePointFitFieldBase *>(passOnePlaneFit)->pointId = value;
-                dynamic_cast<OnePointFitFieldBase *>(passOneSphereFit)->pointId = value;
-                dynamic_cast<OnePointFitFieldBase *>(passOneOrientedSphereFit)->pointId = value;
-                dynamic_cast<OnePointFitFieldBase *>(passScaleView)->pointId = value;
+            pointIdSelector->set_callback([&](int id) {
+                const int value = m_dataMgr->storageId(id); // ids are shown in the order of the file
+                m_dataMgr->processPasses<OnePointFitFieldBase>([value](OnePointFitFieldBase* p){ p->pointId = value; });
+                renderPasses();
+            });
+        }
+
+        {
+            costFieldWidget = new nanogui::Widget(window);
+            costFieldWidget->set_layout(new GroupLayout());
+            new nanogui::Label(costFieldWidget, "Cost", "sans-bold");
+            new nanogui::Label(costFieldWidget, "Metric");
+            auto metricCombo = new nanogui::ComboBox(costFieldWidget,
+                    std::vector<std::string>(CostFieldBase::metricNames.begin(), CostFieldBase::metricNames.end()));
+            metricCombo->set_callback([this](int id) {
+                m_dataMgr->processPasses<CostFieldBase>([id](CostFieldBase* p){ p->metric = CostFieldBase::Metric(id); });
                 renderPasses();
             });
         }
 
-        CONFIG_PONCA_FIT_INTERFACE(planeFitWidget, passPlaneFit, combo->items()[1])
-        CONFIG_PONCA_FIT_INTERFACE(sphereFitWidget, passSphereFit, combo->items()[2])
-        CONFIG_PONCA_FIT_INTERFACE(orientedSphereFitWidget, passOrientedSphereFit, combo->items()[3])
-        CONFIG_PONCA_FIT_INTERFACE(unorientedSphereFitWidget, passUnorientedSphereFit, combo->items()[4])
+        {
+            compareFitsWidget = new nanogui::Widget(window);
+            compareFitsWidget->set_layout(new GroupLayout());
+            new nanogui::Label(compareFitsWidget, "Fit comparison", "sans-bold");
+            const CompareFitsField defaults;
+            new nanogui::Label(compareFitsWidget, "Layout");
+            auto layoutCombo = new nanogui::ComboBox(compareFitsWidget,
+                    std::vector<std::string>(CompareFitsField::layoutNames.begin(), CompareFitsField::layoutNames.end()));
+            layoutCombo->set_selected_index(defaults.layout);
+            layoutCombo->set_callback([this](int id) {
+                m_dataMgr->processPasses<CompareFitsField>([id](CompareFitsField* p){
+                    p->layout = CompareFitsField::Layout(id);
+                });
+                renderPasses();
+            });
+            const std::vector<std::string> fits (CompareFitsField::fitNames.begin(), CompareFitsField::fitNames.end());
+            new nanogui::Label(compareFitsWidget, "Difference: first - second");
+            auto firstCombo = new nanogui::ComboBox(compareFitsWidget, fits);
+            firstCombo->set_selected_index(defaults.first);
+            firstCombo->set_callback([this](int id) {
+                m_dataMgr->processPasses<CompareFitsField>([id](CompareFitsField* p){ p->first = id; });
+                renderPasses();
+            });
+            auto secondCombo = new nanogui::ComboBox(compareFitsWidget, fits);
+            secondCombo->set_selected_index(defaults.second);
+            secondCombo->set_callback([this](int id) {
+                m_dataMgr->processPasses<CompareFitsField>([id](CompareFitsField* p){ p->second = id; });
+                renderPasses();
+            });
+        }
 
         // create pass 3 interface
         {
             pass3Widget = new nanogui::Widget(window);
             pass3Widget->set_layout(new GroupLayout());
             new nanogui::Label(pass3Widget, "Colormap", "sans-bold");
+            new nanogui::Label(pass3Widget, "Displayed channel");
+            std::vector<std::string> channels {"fit output"};
+            channels.insert(channels.end(), FieldBuffer::channelNames.begin(), FieldBuffer::channelNames.end());
+            auto channelCombo = new nanogui::ComboBox(pass3Widget, channels);
+            channelCombo->set_callback([this](int id) {
+                dynamic_cast<ColorMap *>(m_passes[2])->m_channel = id - 1;
+                recolorPasses();
+            });
             new nanogui::Label(pass3Widget, "0-iso color");
             // dunno why, but sets colorpicker in range [0-255], but reads in [0-1]
             auto cp = new ColorPicker(pass3Widget, (dynamic_cast<ColorMap *>(m_passes[2]))->m_isoColor);
             cp->set_final_callback([this](const Color &c) {
                 dynamic_cast<ColorMap *>(m_passes[2])->m_isoColor = c;
-                renderPasses();
+                recolorPasses();
             });
             new nanogui::Label(pass3Widget, "Default color");
             cp = new ColorPicker(pass3Widget, (dynamic_cast<ColorMap *>(m_passes[2]))->m_defaultColor);
             cp->set_final_callback([this](const Color &c) {
                 dynamic_cast<ColorMap *>(m_passes[2])->m_defaultColor = c;
-                renderPasses();
+                recolorPasses();
             });
             new nanogui::Label(pass3Widget, "Number of isolines");
             auto int_box = new IntBox<int>(pass3Widget, dynamic_cast<ColorMap *>(m_passes[2])->m_isoQuantifyNumber);
@@ -301,7 +403,7 @@ namespace poncaplot {
             int_box->set_value_increment(1);
             int_box->set_callback([&](int value) {
                 dynamic_cast<ColorMap *>(m_passes[2])->m_isoQuantifyNumber = value;
-                renderPasses();
+                recolorPasses();
             });
 
             new nanogui::Label(pass3Widget, "0-isoline width");
@@ -310,7 +412,7 @@ namespace poncaplot {
             slider->set_range({0.1, 3.});
             slider->set_callback([&](float value) {
                 dynamic_cast<ColorMap *>(m_passes[2])->m_isoWidth = value;
-                renderPasses();
+                recolorPasses();
             });
         }
 
@@ -324,7 +426,7 @@ namespace poncaplot {
             auto cp = new ColorPicker(pass4Widget, (dynamic_cast<DisplayPoint *>(m_passes[3]))->m_pointColor);
             cp->set_final_callback([this](const Color &c) {
                 dynamic_cast<DisplayPoint *>(m_passes[3])->m_pointColor = c;
-                renderPasses();
+                recolorPasses();
             });
             auto slider = new Slider(pass4Widget);
             slider->set_value(dynamic_cast<DisplayPoint *>(m_passes[3])->m_halfSize);
@@ -332,7 +434,14 @@ namespace poncaplot {
             slider->set_callback([&](float value) {
                 dynamic_cast<DisplayPoint *>(m_passes[3])->m_halfSize = int(value);
                 m_image_view->setSelectionThreshold(value);
-                renderPasses();
+                recolorPasses();
+            });
+            auto densityState = new CheckBox(pass4Widget, "Density map for dense areas");
+            densityState->set_checked(dynamic_cast<DisplayPoint *>(m_passes[3])->m_densityThreshold > 0.f);
+            densityState->set_callback([&](bool state){
+                dynamic_cast<DisplayPoint *>(m_passes[3])->m_densityThreshold =
+                        state ? DisplayPoint::defaultDensityThreshold : 0.f;
+                recolorPasses();
             });
         }
 
@@ -341,11 +450,13 @@ namespace poncaplot {
         window->set_size(Vector2i(768, 768));
         window->set_layout(new GroupLayout(3));
 
-        m_textureBufferPing = new float[tex_width * tex_height * 4]; // use Float32 RGBA textures
-        m_textureBufferPong = new float[tex_width * tex_height * 4]; // use Float32 RGBA textures
+        // passes render in Float32, but the display only needs 8 bits: upload 4 times less data
+        m_textureBuffer = new float[tex_width * tex_height * 4];
+        m_displayBuffer.resize(tex_width * tex_height * 4);
+        m_dirtyBands.resize((tex_height + displayBandHeight - 1) / displayBandHeight);
         m_texture = new Texture(
                 Texture::PixelFormat::RGBA,
-                Texture::ComponentFormat::Float32,
+                Texture::ComponentFormat::UInt8,
                 {tex_width, tex_height},
                 Texture::InterpolationMode::Trilinear,
                 Texture::InterpolationMode::Nearest,
@@ -357,13 +468,19 @@ namespace poncaplot {
         m_image_view->fitImage();
         m_image_view->center();
 
-        buildPassInterface(3);
+        buildPassInterface(defaultPassId);
 
         renderPasses();
-        renderPasses(); // render twice to fill m_textureBufferPing and m_textureBufferPong
+        // the texture content is undefined: upload everything the first time
+        std::fill(m_dirtyBands.begin(), m_dirtyBands.end(), std::make_pair(0, tex_width));
     }
 
 
+    PoncaPlotApplication::~PoncaPlotApplication() {
+        delete m_export;
+        delete[] m_textureBuffer;
+    }
+
     bool
     PoncaPlotApplication::keyboard_event(int key, int scancode, int action, int modifiers) {
         if (Screen::keyboard_event(key, scancode, action, modifiers))
@@ -377,78 +494,184 @@ namespace poncaplot {
 
     void
     PoncaPlotApplication::draw(NVGcontext *ctx) {
-//        if (m_needUpdate)
+        if (m_exportWindow) {
+            m_exportProgress->set_value(m_export->progress());
+            if (!m_export->isRunning()) {
+                m_exportWindow->dispose();
+                m_exportWindow = nullptr;
+                m_exportProgress = nullptr;
+            }
+            redraw(); // keep polling the export job
+        }
         Screen::draw(ctx);
     }
 
     void
     PoncaPlotApplication::draw_contents() {
-        if (m_needUpdate) {
-            m_texture->upload((const uint8_t *) (m_computeInPing ? m_textureBufferPong : m_textureBufferPing));
-            m_needUpdate = false;
+        for (size_t band = 0; band != m_dirtyBands.size(); ++band) {
+            auto &[first, last] = m_dirtyBands[band];
+            if (first >= last) continue;
+            const int y = int(band) * displayBandHeight;
+            const int rows = std::min(displayBandHeight, tex_height - y);
+            const int width = last - first;
+            const uint8_t *data = m_displayBuffer.data() + (y * tex_width + first) * 4;
+            if (width != tex_width) { // sub-image uploads read packed rows
+                m_uploadBuffer.resize(size_t(width * rows * 4));
+                for (int j = 0; j != rows; ++j)
+                    std::copy_n(data + j * tex_width * 4, width * 4, m_uploadBuffer.data() + j * width * 4);
+                data = m_uploadBuffer.data();
+            }
+            m_texture->upload_sub_region(data, {first, y}, {width, rows});
+            first = last = 0;
         }
         Screen::draw_contents();
     }
 
     void
     PoncaPlotApplication::buildPassInterface(int id) {
-        distanceFieldWidget->set_visible(false);
-        genericFitWidget->set_visible(false);
-        singlePointFitWidget->set_visible(false);
-        planeFitWidget->set_visible(false);
-        sphereFitWidget->set_visible(false);
-        orientedSphereFitWidget->set_visible(false);
-        unorientedSphereFitWidget->set_visible(false);
-        switch (id) {
-            case 0:
-                distanceFieldWidget->set_visible(true);
-                break;
-            case 1:
-                genericFitWidget->set_visible(true);
-                planeFitWidget->set_visible(true);
-                break;
-            case 2:
-                genericFitWidget->set_visible(true);
-                sphereFitWidget->set_visible(true);
-                break;
-            case 3:
-                genericFitWidget->set_visible(true);
-                orientedSphereFitWidget->set_visible(true);
-                break;
-            case 4:
-                genericFitWidget->set_visible(true);
-                unorientedSphereFitWidget->set_visible(true);
-                break;
-            case 5:
-            case 6:
-            case 7:
-                break;
-            case 8:
-            case 9:
-            case 10:
-            case 11:
-                genericFitWidget->set_visible(true);
-                singlePointFitWidget->set_visible(true);
-                break;
-            default:
-                throw std::runtime_error("Unknown Field type!");
-        }
+        if (id < 0 || size_t(id) >= DataManager::nbSupportedDrawingPasses)
+            throw std::runtime_error("Unknown Field type!");
+        distanceFieldWidget->set_visible(DrawingPassRegistry::derivesFrom<DistanceFieldWithKdTree>(id));
+        genericFitWidget->set_visible(DrawingPassRegistry::derivesFrom<BaseFitField>(id));
+        singlePointFitWidget->set_visible(DrawingPassRegistry::derivesFrom<OnePointFitFieldBase>(id));
+        compareFitsWidget->set_visible(DrawingPassRegistry::derivesFrom<CompareFitsField>(id));
+        costFieldWidget->set_visible(DrawingPassRegistry::derivesFrom<CostFieldBase>(id));
         perform_layout();
     }
 
     void
     PoncaPlotApplication::renderPasses() {
         std::cout << "[Main] Update texture" << std::endl;
-        renderPassesInternal(1, m_computeInPing ? m_textureBufferPing : m_textureBufferPong);
-        m_computeInPing = !m_computeInPing;
-        m_needUpdate = true;
+        renderPassesInternal(1, m_textureBuffer, m_fields, true);
+        // keep the fit output, to change the colormap without fitting again
+        m_fitOutput.assign(m_textureBuffer, m_textureBuffer + tex_width * tex_height * 4);
+        recolorPasses();
+    }
+
+    void
+    PoncaPlotApplication::recolorPasses() {
+        if (m_fitOutput.empty()) return;
+        std::copy(m_fitOutput.begin(), m_fitOutput.end(), m_textureBuffer);
+        RenderingContext ctx {size_t(tex_width), size_t(tex_height), 1.f, m_dataMgr->getActiveGrid()};
+        ctx.fields = &m_fields;
+        // the 2D points are not displayed on slices of a 3D cloud
+        for (size_t p = 2; p != (m_cloud3 ? 3 : m_passes.size()); ++p)
+            m_passes[p]->render(m_dataMgr->getKdTree(), m_textureBuffer, ctx);
+        updateDisplayBuffer();
+    }
+
+    void
+    PoncaPlotApplication::updateDisplayBuffer() {
+        const int nbBands = int(m_dirtyBands.size());
+#pragma omp parallel for default(none) shared(nbBands) schedule(dynamic, 1)
+        for (int band = 0; band < nbBands; ++band) {
+            int first = tex_width, last = 0;
+            const int yEnd = std::min((band + 1) * displayBandHeight, tex_height);
+            for (int y = band * displayBandHeight; y != yEnd; ++y) {
+                for (int x = 0; x != tex_width; ++x) {
+                    const float *in = m_textureBuffer + (y * tex_width + x) * 4;
+                    uint8_t *out = m_displayBuffer.data() + (y * tex_width + x) * 4;
+                    bool changed = false;
+                    for (int c = 0; c != 4; ++c) {
+                        const auto v = uint8_t(std::clamp(in[c], 0.f, 1.f) * 255.f + 0.5f);
+                        changed |= v != out[c];
+                        out[c] = v;
+                    }
+                    if (changed) {
+                        first = std::min(first, x);
+                        last = std::max(last, x + 1);
+                    }
+                }
+            }
+            // merge with the changes not uploaded yet
+            auto &dirty = m_dirtyBands[band];
+            if (first < last) {
+                dirty = dirty.first < dirty.second ? std::make_pair(std::min(first, dirty.first),
+                                                                    std::max(last, dirty.second))
+                                                   : std::make_pair(first, last);
+            }
+        }
     }
 
     void
-    PoncaPlotApplication::renderPassesInternal(size_t factor, float *buffer) {
-        const auto &points = m_dataMgr->getKdTree();
-        for (auto *p: m_passes) {
-            p->render(points, buffer, {size_t(tex_width*factor), tex_height*factor, 1.f/float(factor)});
+    PoncaPlotApplication::startScaleSweepExport(const std::string &basename) {
+        if (m_export == nullptr) m_export = new ScaleSweepExport();
+        if (m_export->isRunning()) {
+            std::cerr << "Save sequence (scale) error : an export is already running" << std::endl; return;
+        }
+
+        const size_t factor = 2;
+        ScaleSweepExport::Settings settings;
+        settings.scaleStart    = scaleSlider->range().first;
+        settings.scaleEnd      = scaleSlider->range().second - 1;
+        settings.outputPattern = basename + "%04d.png";
+        settings.width         = tex_width * factor;
+        settings.height        = tex_height * factor;
+        settings.pixelScale    = 1.f / float(factor);
+        settings.fitPassId     = m_fitPassId;
+        settings.channel       = static_cast<ColorMap *>(m_passes[2])->m_channel;
+
+        const auto makePasses = [this]() {
+            ScaleSweepExport::PassSet set;
+            set.passes.emplace_back(new FillPass(*static_cast<FillPass *>(m_passes[0])));
+            set.fit = set.passes.emplace_back(DrawingPassRegistry::clone(m_fitPassId, m_passes[1])).get();
+            set.passes.emplace_back(new ColorMap(*static_cast<ColorMap *>(m_passes[2])));
+            set.passes.emplace_back(new DisplayPoint(*static_cast<DisplayPoint *>(m_passes[3])));
+            return set;
+        };
+        if (!m_export->start(*m_dataMgr, makePasses, settings)) return;
+
+        m_exportWindow = new Window(this, "Export");
+        m_exportWindow->set_layout(new GroupLayout());
+        new nanogui::Label(m_exportWindow, "Saving " + std::to_string(m_export->frameCount()) + " frames");
+        m_exportProgress = new ProgressBar(m_exportWindow);
+        auto *b = new Button(m_exportWindow, "Cancel");
+        b->set_callback([this] { m_export->cancel(); });
+        perform_layout();
+        m_exportWindow->center();
+    }
+
+    SlicePlane
+    PoncaPlotApplication::slicePlane() const {
+        using VectorType = SlicePlane::VectorType;
+        // u, v, normal: direct frame
+        const VectorType axes[3] {VectorType::UnitX(), VectorType::UnitY(), VectorType::UnitZ()};
+        SlicePlane plane;
+        plane.u = axes[(m_sliceAxis + 1) % 3];
+        plane.v = axes[(m_sliceAxis + 2) % 3];
+        plane.origin = -0.5f * float(tex_width) * plane.u - 0.5f * float(tex_height) * plane.v
+                       + m_sliceOffset * axes[m_sliceAxis];
+        return plane;
+    }
+
+    void
+    PoncaPlotApplication::renderPassesInternal(size_t factor, float *buffer, FieldBuffer &fields, bool fitOnly) {
+        // the grid is selected by DataManager::renderPass, with the level of detail
+        RenderingContext ctx {size_t(tex_width*factor), tex_height*factor, 1.f/float(factor), nullptr};
+        ctx.schedule = m_schedule;
+        setRenderThreadCount(m_nbThreads);
+        // the displayed image keeps all the channels, so that changing the channel does not fit again
+        const int channel = dynamic_cast<ColorMap *>(m_passes[2])->m_channel;
+        if (fitOnly || channel >= 0) {
+            fields.resize(ctx.w, ctx.h, fitOnly ? FieldBuffer::ALL_CHANNELS : 1u << channel);
+            ctx.fields = &fields;
+        }
+        if (m_cloud3) {
+            // slice of the 3D cloud: the 2D points are not displayed
+            m_passes[0]->render(m_dataMgr->getKdTree(), buffer, ctx);
+            if (supportsSlicing(m_fitPassId)) {
+                m_cloud3->setSlice(slicePlane(), static_cast<BaseFitField *>(m_passes[1])->params.m_scale);
+                renderSlice(m_fitPassId, m_passes[1], *m_cloud3, buffer, ctx);
+            } else
+                std::cerr << DataManager::supportedDrawingPasses[m_fitPassId] << " cannot be used on slices"
+                          << std::endl;
+            if (!fitOnly) m_passes[2]->render(m_dataMgr->getKdTree(), buffer, ctx);
+            return;
+        }
+        m_dataMgr->setLevelOfDetail(!m_exactFits);
+        for (size_t p = 0; p != (fitOnly ? 2 : m_passes.size()); ++p) {
+            if (p == 1) m_dataMgr->renderPass(m_fitPassId, buffer, ctx);
+            else m_passes[p]->render(m_dataMgr->getKdTree(), buffer, ctx);
         }
     }
 }
@@ -8,23 +8,36 @@
 
 #include <nanogui/textbox.h>
 
+#include "fieldBuffer.h"
+
+#include <cstdint>
+#include <memory> // unique_ptr
+#include <utility> // pair
+#include <vector>
+
 // forward declarations
 class DrawingPass;
 class DistanceFieldWithKdTree;
 class MyView;
 class DataManager;
+class PointCloud3;
+struct SlicePlane;
 
 namespace nanogui{
     class Texture;
+    class ProgressBar;
 }
 
 
 
 namespace poncaplot {
+    class ScaleSweepExport;
+
     class PoncaPlotApplication : public nanogui::Screen {
 
     public:
         PoncaPlotApplication(DataManager *mgr);
+        ~PoncaPlotApplication() override;
 
         bool keyboard_event(int key, int scancode, int action, int modifiers) override;
 
@@ -35,15 +48,46 @@ namespace poncaplot {
     private:
         void buildPassInterface(int id);
 
+        /// Render the fit and recolor the displayed image
         void renderPasses();
-        void renderPassesInternal(size_t factor, float *buffer);
+        /// Render the displayed image from the last fit output, see #m_fitOutput
+        void recolorPasses();
+        /// Render the passes at a factor of the texture size
+        /// \param fitOnly stop after the fit pass and fill all the channels of fields, instead of the displayed one
+        void renderPassesInternal(size_t factor, float *buffer, FieldBuffer &fields, bool fitOnly);
+
+        /// Convert m_textureBuffer to 8 bits colors in m_displayBuffer, and record the bands whose pixels changed
+        void updateDisplayBuffer();
+
+        /// Start the export of one image per scale in background, and show its progress
+        void startScaleSweepExport(const std::string &basename);
+
+        /// Plane of the displayed slice of m_cloud3, centered on the image, see #m_sliceAxis and #m_sliceOffset
+        SlicePlane slicePlane() const;
 
     private:
-        float *m_textureBufferPing{nullptr}, *m_textureBufferPong{nullptr};
-        bool m_computeInPing{true};
+        float *m_textureBuffer{nullptr};       //< output of the passes, Float32 RGBA
+        std::vector<uint8_t> m_displayBuffer; //< m_textureBuffer as uploaded to m_texture, UInt8 RGBA
+        /// Changed columns [first,last) of each band of displayBandHeight rows since the last upload, empty if unchanged
+        std::vector<std::pair<int, int>> m_dirtyBands;
+        std::vector<uint8_t> m_uploadBuffer;  //< packed copy of a dirty band narrower than the texture
+        static constexpr int displayBandHeight = 32;
         nanogui::Texture *m_texture{nullptr};
         std::array<DrawingPass *, 4> m_passes{nullptr, nullptr, nullptr, nullptr}; // fill, compute, colormap, point
-        bool m_needUpdate{false};
+        size_t m_fitPassId{0}; //< index of m_passes[1] in the drawing pass registry
+        FieldBuffer m_fields;  //< multi-channel output of the fit pass, all channels
+        std::vector<float> m_fitOutput; //< m_textureBuffer before the colormap, see #recolorPasses
+        int m_nbThreads{0};    //< number of rendering threads, 0: all the cores
+        RenderingContext::Schedule m_schedule{RenderingContext::COST_AWARE};
+        bool m_exactFits{true}; //< fit the full resolution cloud at all scales, see DataManager::setLevelOfDetail
+
+        std::unique_ptr<PointCloud3> m_cloud3; //< 3D cloud rendered by slices instead of the 2D cloud, if any
+        int m_sliceAxis{2};      //< normal of the slicing plane: 0 x, 1 y, 2 z
+        float m_sliceOffset{0};  //< position of the slicing plane along its normal
+
+        ScaleSweepExport *m_export{nullptr};
+        nanogui::Window *m_exportWindow{nullptr};
+        nanogui::ProgressBar *m_exportProgress{nullptr};
 
         DataManager *m_dataMgr{nullptr};
 
@@ -51,14 +95,11 @@ namespace poncaplot {
         Widget *pass1Widget, *distanceFieldWidget,
                 *genericFitWidget,    //< parameters applicable to all fitting techniques
         *singlePointFitWidget,//< parameters applicable to all fitting techniques for a single point
-        *planeFitWidget, *sphereFitWidget, *orientedSphereFitWidget, *unorientedSphereFitWidget,
+                *costFieldWidget,     //< parameters of the cost passes
+                *compareFitsWidget,   //< parameters of the fit comparison pass
                 *pass3Widget, *pass4Widget;
 
         nanogui::IntBox<int> *pointIdSelector{nullptr};
         nanogui::Slider *scaleSlider{nullptr};
-
-        BaseFitField *passPlaneFit, *passSphereFit, *passOrientedSphereFit, *passUnorientedSphereFit,
-                *passOnePlaneFit, *passOneSphereFit, *passOneOrientedSphereFit,
-                *passScaleView;
     };
 }
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+/// Thread-safe FIFO with a fixed capacity, used to connect the stages of a pipeline
+///
+/// push blocks while the queue is full, pop blocks while it is empty. Once closed, push is ignored and pop drains the
+/// remaining elements before returning std::nullopt.
+template <typename T>
+class BoundedQueue {
+public:
+    inline explicit BoundedQueue(size_t capacity) : m_capacity(capacity) {}
+
+    /// \return false if the queue has been closed
+    inline bool push(T value) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this]() { return m_closed || m_values.size() < m_capacity; });
+        if (m_closed) return false;
+        m_values.push_back(std::move(value));
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    /// \return std::nullopt when the queue is closed and empty
+    inline std::optional<T> pop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this]() { return m_closed || !m_values.empty(); });
+        if (m_values.empty()) return std::nullopt;
+        T value = std::move(m_values.front());
+        m_values.pop_front();
+        m_notFull.notify_one();
+        return value;
+    }
+
+    /// Wake up all waiting threads, no more values can be pushed
+    inline void close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+        m_notEmpty.notify_all();
+        m_notFull.notify_all();
+    }
+
+private:
+    const size_t m_capacity;
+    std::deque<T> m_values;
+    bool m_closed{false};
+    std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+};
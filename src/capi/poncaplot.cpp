@@ -0,0 +1,215 @@
+#include "poncaplot.h"
+
+#include "../drawingPass.h"
+#include "../drawingPassRegistry.h"
+#include "../fieldBuffer.h"
+#include "../tileScheduler.h"
+#include "../uniformGrid.h"
+
+#include <algorithm> // copy, max
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace {
+    using IndexedTree = MyKdTreeDense<Ponca::KdTreeDefaultTraits<DataPoint, MyKdTreeNode>>;
+
+    /// Iterator on records stored every stride bytes in caller memory
+    struct RecordIterator {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = PointRecord;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const PointRecord *;
+        using reference = const PointRecord &;
+        const char *p;
+        size_t stride;
+        [[nodiscard]] inline reference operator*() const { return *reinterpret_cast<pointer>(p); }
+        [[nodiscard]] inline pointer operator->() const { return reinterpret_cast<pointer>(p); }
+        inline RecordIterator &operator++() { p += stride; return *this; }
+        inline RecordIterator operator++(int) { RecordIterator it = *this; p += stride; return it; }
+        [[nodiscard]] inline bool operator==(const RecordIterator &o) const { return p == o.p; }
+        [[nodiscard]] inline bool operator!=(const RecordIterator &o) const { return p != o.p; }
+    };
+
+    /// Read-only range of records stored in caller memory, indexed in place by the kd-tree
+    struct RecordSpan {
+        using value_type = PointRecord;
+        const char *b;
+        size_t stride, count;
+        [[nodiscard]] inline RecordIterator begin() const { return {b, stride}; }
+        [[nodiscard]] inline RecordIterator end() const { return {b + count * stride, stride}; }
+        [[nodiscard]] inline RecordIterator cbegin() const { return begin(); }
+        [[nodiscard]] inline RecordIterator cend() const { return end(); }
+        [[nodiscard]] inline size_t size() const { return count; }
+    };
+
+    /// Check if each point starts with a PointRecord, so that the points can be indexed without copy
+    inline bool isRecordLayout(const pp_points &p) {
+        return p.stride >= sizeof(PointRecord) && p.stride % alignof(PointRecord) == 0
+               && p.y == p.x + 1 && p.nx == p.x + 2 && p.ny == p.x + 3
+               && reinterpret_cast<std::uintptr_t>(p.x) % alignof(PointRecord) == 0;
+    }
+
+    /// Set the thread count of a render, and restore the one of the calling thread on exit: the OpenMP setting is
+    /// per thread, and must not leak to the parallel regions of the embedding application
+    class RenderThreadScope {
+    public:
+        explicit RenderThreadScope(int threads) {
+#ifdef _OPENMP
+            m_previous = omp_get_max_threads();
+#endif
+            setRenderThreadCount(threads);
+        }
+        ~RenderThreadScope() {
+#ifdef _OPENMP
+            omp_set_num_threads(m_previous);
+#endif
+        }
+        RenderThreadScope(const RenderThreadScope &) = delete;
+        RenderThreadScope &operator=(const RenderThreadScope &) = delete;
+    private:
+        int m_previous{1};
+    };
+
+    inline double elapsedMs(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+struct pp_context {
+    std::vector<PointRecord> gathered; ///< copy of the points, when they cannot be indexed in place
+    IndexedTree tree;
+    UniformGrid grid;
+    float gridCellSize{-1.f};          ///< cell size of grid, -1 if it must be rebuilt
+    std::array<std::unique_ptr<DrawingPass>, DrawingPassRegistry::size> passes;
+    FillPass fill{{1, 1, 1, 1}};
+    ColorMap cmap{{1, 1, 1, 1}};
+};
+
+static_assert(int(PP_CHANNEL_COUNT) == int(FieldBuffer::NB_CHANNELS) &&
+              int(PP_CHANNEL_NEIGHBOR_COUNT) == int(FieldBuffer::NEIGHBOR_COUNT) &&
+              int(PP_CHANNEL_FIT_STATE) == int(FieldBuffer::FIT_STATE),
+              "pp_channel must match FieldBuffer::Channel");
+
+extern "C" {
+
+pp_context *pp_create(void) {
+    try { return new pp_context; }
+    catch (...) { return nullptr; }
+}
+
+void pp_destroy(pp_context *ctx) { delete ctx; }
+
+const char *pp_status_string(pp_status status) {
+    switch (status) {
+        case PP_OK:               return "ok";
+        case PP_INVALID_ARGUMENT: return "invalid argument";
+        case PP_UNKNOWN_PASS:     return "unknown drawing pass";
+        case PP_NO_POINTS:        return "no points";
+        case PP_INTERNAL_ERROR:   return "internal error";
+    }
+    return "unknown status";
+}
+
+size_t pp_pass_count(void) { return DrawingPassRegistry::size; }
+
+const char *pp_pass_name(size_t index) {
+    // registry names are string literals, hence null-terminated
+    return index < DrawingPassRegistry::size ? DrawingPassRegistry::names()[index].data() : nullptr;
+}
+
+pp_status pp_set_points(pp_context *ctx, const pp_points *points, double *elapsed_ms) {
+    if (!ctx || !points || (points->count != 0 && (!points->x || !points->y || !points->nx || !points->ny)))
+        return PP_INVALID_ARGUMENT;
+    try {
+        const auto start = std::chrono::steady_clock::now();
+        ctx->gridCellSize = -1.f;
+        if (points->count == 0) {
+            ctx->gathered.clear();
+            ctx->tree.clear();
+        } else if (isRecordLayout(*points)) {
+            ctx->gathered.clear();
+            ctx->tree.build(RecordSpan{reinterpret_cast<const char *>(points->x), points->stride, points->count});
+        } else {
+            auto at = [points](const float *a, size_t i) {
+                return *reinterpret_cast<const float *>(reinterpret_cast<const char *>(a) + i * points->stride);
+            };
+            ctx->gathered.resize(points->count);
+            for (size_t i = 0; i != points->count; ++i)
+                ctx->gathered[i] = PointRecord(at(points->x, i), at(points->y, i), at(points->nx, i), at(points->ny, i));
+            ctx->tree.build(ctx->gathered);
+        }
+        if (elapsed_ms) *elapsed_ms = elapsedMs(start);
+        return PP_OK;
+    }
+    catch (...) { return PP_INTERNAL_ERROR; }
+}
+
+pp_render_params pp_default_render_params(void) {
+    const FitParameters fit;
+    return {fit.m_scale, fit.m_iter, 0, 1, 0};
+}
+
+pp_status pp_render(pp_context *ctx, const char *pass_name, const pp_render_params *params,
+                    const pp_region *region, float *out, double *elapsed_ms) {
+    return pp_render_fields(ctx, pass_name, params, region, out, nullptr, elapsed_ms);
+}
+
+pp_status pp_render_fields(pp_context *ctx, const char *pass_name, const pp_render_params *params,
+                           const pp_region *region, float *out, const pp_fields *fields, double *elapsed_ms) {
+    if (!ctx || !pass_name || !params || !region || !out || region->width == 0 || region->height == 0
+        || region->pixel_size <= 0 || params->scale <= 0)
+        return PP_INVALID_ARGUMENT;
+    try {
+        const auto start = std::chrono::steady_clock::now();
+        const auto &names = DrawingPassRegistry::names();
+        size_t index = 0;
+        while (index != names.size() && names[index] != std::string_view(pass_name)) ++index;
+        if (index == names.size()) return PP_UNKNOWN_PASS;
+        if (ctx->tree.point_count() == 0) return PP_NO_POINTS;
+
+        auto &pass = ctx->passes[index];
+        if (!pass) pass.reset(DrawingPassRegistry::create(index));
+        DrawingPassRegistry::visit(index, pass.get(), [params](auto *p) {
+            if constexpr (std::is_base_of_v<BaseFitField, std::remove_pointer_t<decltype(p)>>) {
+                p->params.m_scale = params->scale;
+                p->params.m_iter = std::max(1, params->iterations);
+            }
+        });
+
+        RenderingContext rctx{region->width, region->height, region->pixel_size, nullptr};
+        rctx.x0 = region->x0;
+        rctx.y0 = region->y0;
+        if (params->use_grid) {
+            if (ctx->gridCellSize != params->scale) {
+                ctx->grid.build(ctx->tree.points(), params->scale);
+                ctx->gridCellSize = params->scale;
+            }
+            rctx.grid = &ctx->grid;
+        }
+
+        FieldBuffer buffer;
+        if (fields) {
+            std::array<float *, FieldBuffer::NB_CHANNELS> planes;
+            std::copy(std::begin(fields->planes), std::end(fields->planes), planes.begin());
+            buffer.wrap(region->width, region->height, planes);
+            rctx.fields = &buffer;
+        }
+
+        const RenderThreadScope threads(params->threads);
+        if (params->colormap) ctx->fill.render(ctx->tree, out, rctx);
+        pass->render(ctx->tree, out, rctx);
+        if (params->colormap) ctx->cmap.render(ctx->tree, out, rctx);
+        if (elapsed_ms) *elapsed_ms = elapsedMs(start);
+        return PP_OK;
+    }
+    catch (...) { return PP_INTERNAL_ERROR; }
+}
+
+}
@@ -0,0 +1,117 @@
+/*
+ * C interface of libponcaplot: evaluation of the PoncaPlot drawing passes on caller-owned buffers.
+ *
+ * Typical use, with the points stored as 16-byte aligned x,y,nx,ny records, indexed without copy:
+ *   pp_context *ctx = pp_create();
+ *   pp_points pts = {&rec[0], &rec[1], &rec[2], &rec[3], 4 * sizeof(float), n}; // rec: n*4 floats
+ *   pp_set_points(ctx, &pts, NULL);
+ *   pp_render_params params = pp_default_render_params();
+ *   pp_region region = {512, 512, 0.f, 0.f, 1.f};
+ *   pp_render(ctx, "MLS - Oriented Sphere", &params, &region, image, &ms); // image: 512*512*4 floats
+ *   pp_destroy(ctx);
+ *
+ * Functions never throw: errors are reported as pp_status values.
+ */
+#ifndef PONCAPLOT_CAPI_H
+#define PONCAPLOT_CAPI_H
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#  if defined(PONCAPLOT_BUILD_LIBRARY)
+#    define PONCAPLOT_API __declspec(dllexport)
+#  else
+#    define PONCAPLOT_API __declspec(dllimport)
+#  endif
+#else
+#  define PONCAPLOT_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pp_context pp_context;
+
+typedef enum {
+    PP_OK = 0,
+    PP_INVALID_ARGUMENT,
+    PP_UNKNOWN_PASS,
+    PP_NO_POINTS,
+    PP_INTERNAL_ERROR
+} pp_status;
+
+/* Points given as four float arrays. stride is the distance in bytes between two consecutive points, for all arrays:
+ * sizeof(float) for separate arrays, 4*sizeof(float) for interleaved x,y,nx,ny records.
+ * Normals are expected to be unit vectors. See pp_set_points for the layouts indexed without copy. */
+typedef struct {
+    const float *x, *y, *nx, *ny;
+    size_t stride;
+    size_t count;
+} pp_points;
+
+typedef struct {
+    float scale;       /* fitting scale, in point units */
+    int iterations;    /* MLS projection iterations */
+    int use_grid;      /* use a uniform grid instead of the kd-tree for range queries */
+    int colormap;      /* 1: output RGBA colors, 0: output the raw pass buffer (see ColorMap in drawingPass.h) */
+    int threads;       /* number of threads of the render, 0: all the cores. The OpenMP setting of the calling
+                          thread is restored on return */
+} pp_render_params;
+
+/* Rendered region: pixel (i,j) is evaluated at (x0 + i * pixel_size, y0 + j * pixel_size) */
+typedef struct {
+    size_t width, height;
+    float x0, y0;
+    float pixel_size;
+} pp_region;
+
+/* Channels of the MLS fits, see FieldBuffer in fieldBuffer.h */
+typedef enum {
+    PP_CHANNEL_POTENTIAL = 0,
+    PP_CHANNEL_GRADIENT_X,
+    PP_CHANNEL_GRADIENT_Y,
+    PP_CHANNEL_GRADIENT_NORM,
+    PP_CHANNEL_CURVATURE,
+    PP_CHANNEL_NEIGHBOR_COUNT,
+    PP_CHANNEL_FIT_STATE,
+    PP_CHANNEL_COUNT
+} pp_channel;
+
+/* Caller-owned planes of width*height floats, indexed by pp_channel. NULL planes are not computed */
+typedef struct {
+    float *planes[PP_CHANNEL_COUNT];
+} pp_fields;
+
+PONCAPLOT_API pp_context *pp_create(void);
+PONCAPLOT_API void pp_destroy(pp_context *ctx);
+
+PONCAPLOT_API const char *pp_status_string(pp_status status);
+
+/* Names of the drawing passes accepted by pp_render */
+PONCAPLOT_API size_t pp_pass_count(void);
+PONCAPLOT_API const char *pp_pass_name(size_t index);
+
+/* Index the points. Interleaved records starting with x,y,nx,ny (consecutive floats, 16-byte aligned, stride a
+ * multiple of 16 bytes) are indexed in place: they must stay valid and unchanged until the next call to pp_set_points
+ * or pp_destroy. Other layouts, including separate arrays, are copied once to records.
+ * elapsed_ms (optional) receives the indexing time. */
+PONCAPLOT_API pp_status pp_set_points(pp_context *ctx, const pp_points *points, double *elapsed_ms);
+
+PONCAPLOT_API pp_render_params pp_default_render_params(void);
+
+/* Render a pass in out, width*height*4 floats. elapsed_ms (optional) receives the rendering time. */
+PONCAPLOT_API pp_status pp_render(pp_context *ctx, const char *pass_name, const pp_render_params *params,
+                                  const pp_region *region, float *out, double *elapsed_ms);
+
+/* Same as pp_render, also writing the channels of the fit to fields, in the same pass. Only the MLS passes write the
+ * channels: values are NaN where the fit is not defined, except for the number of neighbors and the fit state. */
+PONCAPLOT_API pp_status pp_render_fields(pp_context *ctx, const char *pass_name, const pp_render_params *params,
+                                         const pp_region *region, float *out, const pp_fields *fields,
+                                         double *elapsed_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PONCAPLOT_CAPI_H */
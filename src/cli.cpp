@@ -4,9 +4,95 @@
 #include "dataManager.h"
 #include "drawingPass.h"
 
+#include "boundedQueue.h"
+#include "contourTracing.h"
+#include "descriptors.h"
+#include "fieldExport.h"
+#include "fieldValidation.h"
+#include "renderServer.h"
+#include "scaleSweep.h"
+#include "slicing.h"
+#include "syntheticCloud.h"
+#include "tileScheduler.h"
+#include "tiledStore.h"
+
 #include "argparse/argparse.hpp"
 
+#include <algorithm> // find, sort
+#include <array>
+#include <chrono>
+#include <cmath>     // floor
+#include <filesystem>
+#include <memory>    // unique_ptr
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>   // pair
+
 namespace poncaplot {
+    namespace {
+        /// Match a file name against a pattern with * and ? wildcards
+        bool matchWildcard(const char *pattern, const char *name) {
+            if (*pattern == '\0') return *name == '\0';
+            if (*pattern == '*')
+                return matchWildcard(pattern + 1, name) || (*name != '\0' && matchWildcard(pattern, name + 1));
+            if (*name == '\0') return false;
+            return (*pattern == '?' || *pattern == *name) && matchWildcard(pattern + 1, name + 1);
+        }
+
+        /// Expand the wildcards in file names (only in the last path component), keep the other entries as is
+        std::vector<std::string> expandFramePatterns(const std::vector<std::string> &patterns) {
+            namespace fs = std::filesystem;
+            std::vector<std::string> frames;
+            for (const auto &pattern: patterns) {
+                if (pattern.find_first_of("*?") == std::string::npos) {
+                    frames.push_back(pattern);
+                    continue;
+                }
+                const fs::path p(pattern);
+                const fs::path dir = p.has_parent_path() ? p.parent_path() : fs::path(".");
+                const std::string filePattern = p.filename().string();
+                std::vector<std::string> matches;
+                std::error_code ec;
+                for (const auto &entry: fs::directory_iterator(dir, ec))
+                    if (entry.is_regular_file() && matchWildcard(filePattern.c_str(), entry.path().filename().string().c_str()))
+                        matches.push_back(entry.path().string());
+                std::sort(matches.begin(), matches.end());
+                frames.insert(frames.end(), matches.begin(), matches.end());
+            }
+            return frames;
+        }
+
+        /// Parse a scale range given as start:end[:step]
+        std::array<float, 3> parseScaleRange(const std::string &str) {
+            std::array<float, 3> range{0, 0, 1};
+            std::istringstream is(str);
+            std::string value;
+            int i = 0;
+            while (i < 3 && std::getline(is, value, ':')) range[i++] = std::stof(value);
+            if (i < 2 || range[2] <= 0 || range[1] < range[0])
+                throw std::runtime_error("Invalid scale range: " + str + " (expected start:end[:step])");
+            return range;
+        }
+
+        inline bool isTiledFile(const std::string &path) {
+            return path.size() >= 8 && path.compare(path.size() - 8, 8, ".pptiles") == 0;
+        }
+
+        /// Parse n comma-separated floats
+        std::vector<float> parseFloats(const std::string &str, size_t n, const std::string &what) {
+            std::vector<float> values;
+            std::istringstream is(str);
+            std::string value;
+            while (std::getline(is, value, ',')) values.push_back(std::stof(value));
+            if (values.size() != n)
+                throw std::runtime_error("Invalid " + what + ": " + str);
+            return values;
+        }
+    }
+
     PoncaPlotCLI::PoncaPlotCLI(DataManager *mgr) : m_dataMgr(mgr) {
 
     }
@@ -16,34 +102,77 @@ namespace poncaplot {
 
         struct {
             std::string inputPath{};
+            std::vector<std::string> sequence{};
             struct {
-                std::string name{"Oriented Sphere"};
+                std::string name{"MLS - Oriented Sphere"};
                 float scale{40};
                 unsigned int pointId{0};
+                std::string index{"kdtree"};
+                std::optional<std::array<float, 3>> scaleRange{}; // start, end, step
+                std::string channel{};
+                std::string costMetric{"neighbors"};
+                std::string compareLayout{"grid"};
+                std::array<int, 2> comparePair{0, 2}; // indices in CompareFitsField::fitNames
             } fitting;
             struct {
                 bool renderTrajectories{false};
             } display;
+            struct {
+                std::optional<SlicePlane> plane{};
+                int count{1};
+                float step{0};
+            } slice;
+            struct {
+                int threads{0}; // 0: all the cores
+                std::string schedule{"cost"};
+                bool levelOfDetail{false}; // fit a level of detail at large scales instead of the full cloud
+            } performance;
+            struct {
+                std::string mode{}; // approximate mode compared to the exact render, empty if no validation
+                ValidationThresholds thresholds{};
+            } validation;
             struct {
                 std::string path{};
                 size_t width{500};
                 size_t height{500};
+                std::string descriptorsPath{};
+                std::string fieldPath{};
+                std::string contourPath{};
+                float x0{0}, y0{0}; // point coordinates of the first pixel
+                float contourStep{1};
+                unsigned int fieldChannels{0}; // FieldBuffer channels saved with the field
             } output;
         } params;
 
-        std::vector<std::string> names;
-        names.resize(m_dataMgr->nbSupportedDrawingPasses);
-        for (const auto &p: m_dataMgr->supportedDrawingPasses)
-            names[p.second] = p.first;
         std::string namesStr;
-        for (const auto &n: names)
-            namesStr.append("\"" + n + "\" ");
+        for (const auto &n: m_dataMgr->supportedDrawingPasses)
+            namesStr.append("\"" + std::string(n) + "\" ");
+
 
+        std::string channelsStr;
+        for (const auto &c: FieldBuffer::channelNames)
+            channelsStr.append(std::string(c) + " ");
 
         argparse::ArgumentParser program("poncaplot-cli");
         program.add_argument("-i", "--input")
-                .required()
                 .help("input file (.pts or .txt)");
+        program.add_argument("--serve")
+                .help("run as a render service: read requests on stdin and answer on stdout, keeping the clouds "
+                      "loaded between requests (see renderServer.h for the protocol)")
+                .default_value(false)
+                .implicit_value(true);
+        program.add_argument("--sequence")
+                .help("input files, one per frame, rendered as a sequence (wildcards * and ? are expanded). "
+                      "Requires an output pattern, e.g. -o frame_%04d.png")
+                .nargs(argparse::nargs_pattern::at_least_one);
+        auto &gen = program.add_argument("--generate")
+                .help("use a synthetic point cloud instead of -i: [circle line clusters]");
+        for (const auto &s: syntheticShapeNames)
+            gen.add_choice(std::string(s));
+        program.add_argument("--generate-count")
+                .help("number of points of --generate")
+                .scan<'i', size_t>()
+                .default_value(size_t(2000));
 
         // output controls
         {
@@ -57,6 +186,22 @@ namespace poncaplot {
                     .help("output image height (in pixels)")
                     .scan<'i', size_t>()
                     .default_value(params.output.height);
+            program.add_argument("--descriptors")
+                    .help("compute the fit parameters of every point, for the scale -s or the scales of --scale-range, "
+                          "and save them to a file (.csv, binary otherwise). The fit is given by -f if it is a MLS fit");
+            program.add_argument("--field")
+                    .help("save the raw field (value and validity planes) as float32, with or instead of the image: "
+                          ".npy, or raw bytes with a JSON sidecar otherwise");
+            program.add_argument("--contour")
+                    .help("trace the zero-isocontour of the signed MLS fit -f from the input points, without rendering the "
+                          "field, and save it as polylines (.csv, .svg otherwise). With -o, the curves are also "
+                          "rasterized to the image");
+            program.add_argument("--contour-step")
+                    .help("distance between two samples of the contours (in pixels)")
+                    .scan<'g', float>()
+                    .default_value(params.output.contourStep);
+            program.add_argument("--field-channels")
+                    .help("comma-separated fit channels saved with --field (all, or among: " + channelsStr + ")");
         }
 
         // fitting controls
@@ -65,12 +210,41 @@ namespace poncaplot {
                     .default_value(params.fitting.name)
                     .help("fit type: [" + namesStr + "]");
             for (const auto &type: m_dataMgr->supportedDrawingPasses)
-                ft.add_choice(type.first);
+                ft.add_choice(std::string(type));
 
             program.add_argument("-s")
                     .help("scale size (in pixels)")
                     .scan<'g', float>()
                     .default_value(params.fitting.scale);
+            program.add_argument("--index")
+                    .default_value(params.fitting.index)
+                    .help("spatial index used for range queries: [\"kdtree\" \"grid\"]")
+                    .add_choice("kdtree")
+                    .add_choice("grid");
+            auto &ch = program.add_argument("--channel")
+                    .help("display a channel of the fit instead of its potential: [fit " + channelsStr + "]")
+                    .default_value(std::string("fit"))
+                    .add_choice("fit");
+            for (const auto &c: FieldBuffer::channelNames)
+                ch.add_choice(std::string(c));
+            program.add_argument("--scale-range")
+                    .help("render one image per scale, in range start:end[:step] (in pixels). "
+                          "Requires an output pattern, e.g. -o scale_%04d.png");
+            auto &cm = program.add_argument("--cost-metric")
+                    .help("cost rendered by the Cost passes: [neighbors nodes iterations time]")
+                    .default_value(params.fitting.costMetric);
+            for (const auto &m: CostFieldBase::metricNames)
+                cm.add_choice(std::string(m));
+            auto &cl = program.add_argument("--compare-layout")
+                    .help("layout of the \"Compare - MLS fits\" pass: one quadrant per fit, or the difference of "
+                          "two fits (see --compare-pair): [grid difference]")
+                    .default_value(params.fitting.compareLayout);
+            for (const auto &l: CompareFitsField::layoutNames)
+                cl.add_choice(std::string(l));
+            program.add_argument("--compare-pair")
+                    .help("fits of the difference layout, as first,second: the first minus the second, among "
+                          "[plane sphere oriented unoriented]")
+                    .default_value(std::string("plane,oriented"));
             // one point fit
             program.add_argument("-p", "--pointId")
                     .help("point id for one point fit")
@@ -82,19 +256,164 @@ namespace poncaplot {
                     .default_value(params.display.renderTrajectories);
         }
 
+        // out-of-core controls
+        {
+            program.add_argument("--build-tiles")
+                    .help("bucket the points of -i into a tile file (.pptiles) for out-of-core rendering, and exit. "
+                          "A .pptiles file given to -i only loads the tiles overlapping the rendered region");
+            program.add_argument("--tile-size")
+                    .help("side of the tiles of --build-tiles (in pixels)")
+                    .scan<'g', float>()
+                    .default_value(1024.f);
+            program.add_argument("--region")
+                    .help("coordinates of the first pixel of the output image, x0,y0 (in pixels)");
+        }
+
+        // 3D slicing controls
+        {
+            program.add_argument("--slice")
+                    .help("load -i as a 3D cloud (x y z [nx ny nz], or .bin float32 records x y z nx ny nz) and render "
+                          "the fit -f on a plane given as ox,oy,oz,ux,uy,uz,vx,vy,vz (origin and image axes)");
+            program.add_argument("--slice-sweep")
+                    .help("render count slices, moved by step along the plane normal: count:step. "
+                          "Requires an output pattern, e.g. -o slice_%04d.png");
+        }
+
+        // performance controls
+        {
+            program.add_argument("--threads")
+                    .help("number of threads used for rendering and descriptors (0: all the cores)")
+                    .scan<'i', int>()
+                    .default_value(params.performance.threads);
+            auto &sc = program.add_argument("--schedule")
+                    .help("distribution of the image tiles between the threads of the fit passes: "
+                          "[static dynamic cost]")
+                    .default_value(params.performance.schedule);
+            for (const auto &s: RenderingContext::scheduleNames)
+                sc.add_choice(std::string(s));
+            program.add_argument("--validate")
+                    .help("render the fit -f exactly and with an approximate mode, report the field error, "
+                          "validity mismatches, isocontour shift and speedup, and fail if a threshold is exceeded: "
+                          "[lod grid]")
+                    .add_choice("lod")
+                    .add_choice("grid");
+            program.add_argument("--validate-thresholds")
+                    .help("thresholds of --validate: max error and RMS error (relative to the scale), isocontour "
+                          "shift (pixels), validity mismatches (ratio of the pixels), as max,rms,shift,mismatch")
+                    .default_value(std::string("0.05,0.01,2,0.01"));
+            program.add_argument("--reorder")
+                    .help("store the points in kd-tree leaf order, so that neighbors are contiguous in memory. "
+                          "Point ids (-p) and exports keep the order of the input file")
+                    .default_value(false)
+                    .implicit_value(true);
+            program.add_argument("--leaf-size")
+                    .help("maximum number of points in the kd-tree leaves, instead of the tuned value (see "
+                          "--tune-leaf-size) or the default (" + std::to_string(DataManager::defaultLeafSize) + ")")
+                    .scan<'i', int>();
+            program.add_argument("--tune-leaf-size")
+                    .help("time the range queries of the scale -s with several leaf sizes, and save the fastest one "
+                          "in <input>.tuning, used when the cloud is loaded")
+                    .default_value(false)
+                    .implicit_value(true);
+            program.add_argument("--lod")
+                    .help("fit a level of detail whose spacing is a tenth of the scale, instead of the full "
+                          "resolution point cloud: faster at large scales, but approximate")
+                    .default_value(params.performance.levelOfDetail)
+                    .implicit_value(true);
+        }
+
         // return value of the method: do we skip the GUI ?
         bool skipGUI = true;
 
         bool loaded = false;
+        TiledPointStore tiles; // out-of-core cloud, when -i is a tile file
         try {
             program.parse_args(argc, argv);
-            params.inputPath = program.get("-i");
-            if (!params.inputPath.empty()) {
-                loaded = m_dataMgr->loadPointCloud(params.inputPath);;
+            if (program.get<bool>("--serve")) {
+                // logs go to stderr, stdout is reserved to the answers
+                std::ostream answers(std::cout.rdbuf());
+                std::cout.rdbuf(std::cerr.rdbuf());
+                RenderServer(std::cin, answers).run();
+                std::cout.rdbuf(answers.rdbuf());
+                return skipGUI;
+            }
+            if (program.is_used("--sequence")) {
+                params.sequence = expandFramePatterns(program.get<std::vector<std::string>>("--sequence"));
+                if (params.sequence.empty())
+                    throw std::runtime_error("No input file matching --sequence");
+                if (!program.present("-o"))
+                    throw std::runtime_error("--sequence requires an output pattern (-o)");
+            } else if (program.is_used("-i"))
+                params.inputPath = program.get("-i");
+            else if (!program.is_used("--generate"))
+                throw std::runtime_error("-i, --sequence or --generate required");
+
+            if (!params.inputPath.empty() || !params.sequence.empty() || program.is_used("--generate")) {
+                if (program.is_used("--slice")) {
+                    if (params.inputPath.empty())
+                        throw std::runtime_error("--slice requires an input file (-i)");
+                    const auto s = parseFloats(program.get("--slice"), 9, "slicing plane");
+                    params.slice.plane = SlicePlane::fromAxes({s[0], s[1], s[2]}, {s[3], s[4], s[5]},
+                                                              {s[6], s[7], s[8]});
+                    if (program.is_used("--slice-sweep")) {
+                        const auto sweep = parseFloats(program.get("--slice-sweep"), 2, "slice sweep");
+                        params.slice.count = std::max(1, int(sweep[0]));
+                        params.slice.step = sweep[1];
+                    }
+                } else if (program.is_used("--build-tiles")) {
+                    if (params.inputPath.empty())
+                        throw std::runtime_error("--build-tiles requires an input file (-i)");
+                    if (!TiledPointStore::build(params.inputPath, program.get("--build-tiles"),
+                                                program.get<float>("--tile-size")))
+                        std::cerr << "Cannot build tiles from " << params.inputPath << std::endl;
+                    return skipGUI;
+                } else if (isTiledFile(params.inputPath)) {
+                    if (program.is_used("--descriptors") || program.is_used("--contour") ||
+                        program.is_used("--scale-range") || !program.present("-o"))
+                        throw std::runtime_error("tiled clouds only support single image renders (-o)");
+                    loaded = tiles.open(params.inputPath);
+                } else if (!params.inputPath.empty())
+                    loaded = m_dataMgr->loadPointCloud(params.inputPath);
+                else if (program.is_used("--generate")) {
+                    const auto &names = syntheticShapeNames;
+                    const auto shape = std::find(names.begin(), names.end(), program.get("--generate"));
+                    m_dataMgr->getPointContainer() = generateCloud(SyntheticShape(shape - names.begin()),
+                                                                   program.get<size_t>("--generate-count"));
+                    m_dataMgr->updateKdTree();
+                    loaded = true;
+                }
+                if (program.is_used("--region")) {
+                    const auto r = parseFloats(program.get("--region"), 2, "region");
+                    params.output.x0 = r[0];
+                    params.output.y0 = r[1];
+                }
 
                 // load fit properties
                 if (program.is_used("-f")) params.fitting.name = program.get("-f");
                 if (program.is_used("-s")) params.fitting.scale = program.get<float>("-s");
+                if (program.is_used("--index")) params.fitting.index = program.get("--index");
+                if (program.is_used("--channel")) params.fitting.channel = program.get("--channel");
+                if (program.is_used("--cost-metric")) params.fitting.costMetric = program.get("--cost-metric");
+                if (program.is_used("--compare-layout"))
+                    params.fitting.compareLayout = program.get("--compare-layout");
+                if (program.is_used("--compare-pair")) {
+                    std::istringstream is(program.get("--compare-pair"));
+                    std::string name;
+                    size_t k = 0;
+                    while (std::getline(is, name, ',')) {
+                        const auto &names = CompareFitsField::fitNames;
+                        const auto it = std::find(names.begin(), names.end(), name);
+                        if (k == 2 || it == names.end())
+                            throw std::runtime_error("Invalid --compare-pair: " + program.get("--compare-pair"));
+                        params.fitting.comparePair[k++] = int(it - names.begin());
+                    }
+                    if (k != 2) throw std::runtime_error("--compare-pair requires two fits");
+                }
+                if (program.is_used("--scale-range")) {
+                    if (!params.sequence.empty())
+                        throw std::runtime_error("--scale-range cannot be used with --sequence");
+                    params.fitting.scaleRange = parseScaleRange(program.get("--scale-range"));
+                }
 
                 // load one point fit properties
                 if (program.is_used("-p")) params.fitting.pointId = program.get<unsigned int>("-p");
@@ -102,10 +421,81 @@ namespace poncaplot {
                 // load display properties
                 if (program.is_used("-t")) params.display.renderTrajectories = program.get<bool>("-t");
 
-                // load output properties
+                // load performance properties
+                if (program.is_used("--threads")) params.performance.threads = program.get<int>("--threads");
+                if (program.is_used("--schedule")) params.performance.schedule = program.get("--schedule");
+                if (program.is_used("--lod")) params.performance.levelOfDetail = program.get<bool>("--lod");
+                if (program.is_used("--leaf-size") || program.get<bool>("--tune-leaf-size")) {
+                    if (!loaded || tiles.isOpen())
+                        throw std::runtime_error("leaf size options require a point cloud file (-i)");
+                    if (program.is_used("--leaf-size"))
+                        m_dataMgr->setLeafSize(program.get<int>("--leaf-size"));
+                    else {
+                        if (params.inputPath.empty())
+                            throw std::runtime_error("--tune-leaf-size requires a point cloud file (-i)");
+                        std::cout << "Tune leaf size for scale " << params.fitting.scale << std::endl;
+                        for (const auto &t: m_dataMgr->tuneLeafSize(params.fitting.scale))
+                            std::cout << "  leaf size " << t.leafSize << ": " << t.ms << " ms" << std::endl;
+                        const auto path = DataManager::tuningPath(params.inputPath);
+                        std::cout << "Selected leaf size " << m_dataMgr->getLeafSize() << ", saved to " << path
+                                  << std::endl;
+                        if (!m_dataMgr->saveTuning(path)) std::cerr << "Cannot save " << path << std::endl;
+                        return skipGUI;
+                    }
+                }
+                if (program.get<bool>("--reorder") && loaded && !tiles.isOpen()) m_dataMgr->reorderPoints();
+
+                // load output properties: one output mode, options of the other modes are rejected
                 auto output = program.present("-o");
-                if (output) {
-                    params.output.path = output.value();
+                if (int(program.is_used("--contour")) + int(program.is_used("--descriptors")) +
+                    int(program.is_used("--validate")) > 1)
+                    throw std::runtime_error("--contour, --descriptors and --validate cannot be combined");
+                if (program.is_used("--contour")) {
+                    if (!loaded || tiles.isOpen())
+                        throw std::runtime_error("--contour requires a point cloud (-i or --generate)");
+                    if (program.is_used("--field"))
+                        throw std::runtime_error("--field cannot be used with --contour");
+                    params.output.contourPath = program.get("--contour");
+                    params.output.contourStep = program.get<float>("--contour-step");
+                    if (params.output.contourStep <= 0)
+                        throw std::runtime_error("--contour-step must be positive");
+                    if (output) params.output.path = output.value();
+                    if (program.is_used("-W")) params.output.width = program.get<size_t>("-W");
+                    if (program.is_used("-H")) params.output.height = program.get<size_t>("-H");
+                } else if (program.is_used("--descriptors")) {
+                    if (!loaded || tiles.isOpen())
+                        throw std::runtime_error("--descriptors requires a point cloud (-i or --generate)");
+                    if (output || program.is_used("--field") || program.is_used("-W") || program.is_used("-H"))
+                        throw std::runtime_error("--descriptors saves no image: -o, --field, -W and -H cannot be used "
+                                                 "with it");
+                    params.output.descriptorsPath = program.get("--descriptors");
+                } else if (program.is_used("--validate")) {
+                    if (!loaded || tiles.isOpen())
+                        throw std::runtime_error("--validate requires a point cloud (-i or --generate)");
+                    if (output || program.is_used("--field"))
+                        throw std::runtime_error("--validate saves no image: -o and --field cannot be used with it");
+                    params.validation.mode = program.get("--validate");
+                    const auto t = parseFloats(program.get("--validate-thresholds"), 4, "validation thresholds");
+                    params.validation.thresholds = {t[0], t[1], t[2], t[3]};
+                    if (program.is_used("-W")) params.output.width = program.get<size_t>("-W");
+                    if (program.is_used("-H")) params.output.height = program.get<size_t>("-H");
+                } else if (output || program.is_used("--field")) {
+                    if (program.is_used("--field")) {
+                        if (params.fitting.scaleRange || !params.sequence.empty())
+                            throw std::runtime_error("--field is only supported for single images");
+                        params.output.fieldPath = program.get("--field");
+                        if (program.is_used("--field-channels")) {
+                            std::istringstream is(program.get("--field-channels"));
+                            std::string name;
+                            while (std::getline(is, name, ',')) {
+                                const int c = FieldBuffer::channelIndex(name);
+                                if (name == "all") params.output.fieldChannels = FieldBuffer::ALL_CHANNELS;
+                                else if (c < 0) throw std::runtime_error("Unknown channel: " + name);
+                                else params.output.fieldChannels |= 1u << c;
+                            }
+                        }
+                    }
+                    if (output) params.output.path = output.value();
                     if (program.is_used("-W")) params.output.width = program.get<size_t>("-W");
                     if (program.is_used("-H")) params.output.height = program.get<size_t>("-H");
                 } else
@@ -118,21 +508,156 @@ namespace poncaplot {
             skipGUI = false;
         }
 
-        // configure and do rendering
-        if (loaded && skipGUI) {
-            auto texture = new float[params.output.width * params.output.height * 4];
+        setRenderThreadCount(params.performance.threads);
+        for (size_t s = 0; s != RenderingContext::scheduleNames.size(); ++s)
+            if (RenderingContext::scheduleNames[s] == params.performance.schedule)
+                m_schedule = RenderingContext::Schedule(s);
+
+        // render slices of a 3D cloud
+        if (skipGUI && params.slice.plane) {
+            if (params.output.path.empty()) {
+                std::cerr << "--slice requires an output image (-o)" << std::endl;
+                return skipGUI;
+            }
+            PointCloud3 cloud;
+            if (!cloud.load(params.inputPath)) {
+                std::cerr << "Cannot load " << params.inputPath << std::endl;
+                return skipGUI;
+            }
+            const auto passId = DataManager::getDrawingPassIndex(params.fitting.name);
+            if (!supportsSlicing(passId)) {
+                std::cerr << params.fitting.name << " cannot be used on slices, use one of:";
+                for (size_t p = 0; p != DataManager::nbSupportedDrawingPasses; ++p)
+                    if (supportsSlicing(p)) std::cerr << " \"" << DataManager::supportedDrawingPasses[p] << "\"";
+                std::cerr << std::endl;
+                return skipGUI;
+            }
+            auto *pass = m_dataMgr->getDrawingPass(passId);
+            static_cast<BaseFitField *>(pass)->params.m_scale = params.fitting.scale;
+            FillPass fill({1, 1, 1, 1});
+            ColorMap cmap({1, 1, 1, 1});
+            std::vector<float> texture(params.output.width * params.output.height * 4);
+            RenderingContext ctx {params.output.width, params.output.height, 1.f, nullptr};
+            ctx.schedule = m_schedule;
+            for (int s = 0; s != params.slice.count; ++s) {
+                cloud.setSlice(params.slice.plane->offset(float(s) * params.slice.step), params.fitting.scale);
+                fill.render(m_dataMgr->getKdTree(), texture.data(), ctx);
+                renderSlice(passId, pass, cloud, texture.data(), ctx);
+                cmap.render(m_dataMgr->getKdTree(), texture.data(), ctx);
+                const auto path = params.slice.count > 1 ? formatFramePath(params.output.path, size_t(s))
+                                                         : params.output.path;
+                write_image(int(ctx.w), int(ctx.h), texture.data(), path);
+                std::cout << "Saved " << path << " (" << cloud.slabSize() << " points in slab)" << std::endl;
+            }
+            return skipGUI;
+        }
+
+        // trace the zero-isocontour instead of rendering the field
+        if (loaded && skipGUI && !params.output.contourPath.empty()) {
+            const auto passId = DataManager::getDrawingPassIndex(params.fitting.name);
+            if (!DrawingPassRegistry::satisfies<IsSignedFitField>(passId)) {
+                std::cerr << params.fitting.name << " has no zero-isocontour, use a signed MLS fit:";
+                for (size_t p = 0; p != DataManager::nbSupportedDrawingPasses; ++p)
+                    if (DrawingPassRegistry::satisfies<IsSignedFitField>(p))
+                        std::cerr << " \"" << DataManager::supportedDrawingPasses[p] << "\"";
+                std::cerr << std::endl;
+                m_exitCode = 1;
+                return skipGUI;
+            }
+            FitParameters fitParams;
+            fitParams.m_scale = params.fitting.scale;
+            std::vector<Polyline> curves;
+            m_dataMgr->processPass(passId, [&](auto *pass) {
+                using PassType = std::remove_pointer_t<decltype(pass)>;
+                if constexpr (IsSignedFitField<PassType>::value) {
+                    fitParams.m_iter = pass->params.m_iter;
+                    ContourTracer<typename PassType::FitType, typename PassType::PostProcess> tracer(
+                            m_dataMgr->getKdTree(), fitParams, params.output.contourStep);
+                    curves = tracer.trace();
+                }
+            });
+            size_t nbSamples = 0;
+            for (const auto &c: curves) nbSamples += c.size();
+            std::cout << "Traced " << curves.size() << " curves (" << nbSamples << " samples)" << std::endl;
+            if (!writePolylines(curves, params.output.contourPath, params.output.width, params.output.height)) {
+                std::cerr << "Cannot save contours to " << params.output.contourPath << std::endl;
+                m_exitCode = 1;
+            }
+
+            if (!params.output.path.empty()) {
+                // rasterized overlay
+                FillPass fill({1, 1, 1, 1});
+                std::vector<float> texture(params.output.width * params.output.height * 4);
+                RenderingContext ctx {params.output.width, params.output.height, 1.f, nullptr};
+                fill.render(m_dataMgr->getKdTree(), texture.data(), ctx);
+                for (const auto &c: curves)
+                    for (size_t k = 1; k < c.size(); ++k)
+                        fill.bresenham(ctx.pointToPix(c[k - 1]), ctx.pointToPix(c[k]), {ctx.w, ctx.h},
+                                       [&texture, &ctx](int x, int y) {
+                                           auto *b = texture.data() + (x + y * ctx.w) * 4;
+                                           b[0] = b[1] = b[2] = 0.f;
+                                           b[3] = 1.f;
+                                       });
+                write_image(int(ctx.w), int(ctx.h), texture.data(), params.output.path);
+            }
+            return skipGUI;
+        }
+
+        // compute per-point descriptors instead of rendering
+        if (loaded && skipGUI && !params.output.descriptorsPath.empty()) {
+            std::vector<float> scales{params.fitting.scale};
+            if (params.fitting.scaleRange) {
+                const auto &r = *params.fitting.scaleRange;
+                const int nbScales = int(std::floor((r[1] - r[0]) / r[2])) + 1;
+                scales.clear();
+                for (int s = 0; s != nbScales; ++s) scales.push_back(r[0] + float(s) * r[2]);
+            }
 
+            const auto passId = DataManager::getDrawingPassIndex(params.fitting.name);
+            bool saved = false;
+            m_dataMgr->processPass(passId, [&](auto *pass) {
+                using PassType = std::remove_pointer_t<decltype(pass)>;
+                if constexpr (!IsFitField<PassType>::value)
+                    std::cout << params.fitting.name << " is not a MLS fit: use MLS - Oriented Sphere" << std::endl;
+                using FitPass = std::conditional_t<IsFitField<PassType>::value, PassType, OrientedSphereFitField>;
+                saved = computeMultiScaleDescriptors<typename FitPass::FitType, typename FitPass::PostProcess>(
+                        m_dataMgr->getKdTree(), scales, params.output.descriptorsPath, m_dataMgr->getStorageIds());
+            });
+            if (!saved) std::cerr << "Cannot save descriptors to " << params.output.descriptorsPath << std::endl;
+            return skipGUI;
+        }
+
+        // configure and do rendering
+        if ((loaded || !params.sequence.empty()) && skipGUI) {
             // configure fitting
             std::cout << "Configure fitting" << std::endl;
-            auto pass = m_dataMgr->getDrawingPass(params.fitting.name);
+            const auto passId = DataManager::getDrawingPassIndex(params.fitting.name);
+            auto pass = m_dataMgr->getDrawingPass(passId);
             pass->drawingParams.renderTrajectories = params.display.renderTrajectories;
 
-            if (auto fit = dynamic_cast<BaseFitField *>(pass)) {
-                fit->params.m_scale = params.fitting.scale;
-            }
-            if (auto fit = dynamic_cast<OnePointFitFieldBase *>(pass)) {
-                fit->pointId = params.fitting.pointId;
-            }
+            m_dataMgr->processPass(passId, [this, &params](auto* fit) {
+                using PassType = std::remove_pointer_t<decltype(fit)>;
+                if constexpr (std::is_base_of_v<BaseFitField, PassType>)
+                    fit->params.m_scale = params.fitting.scale;
+                if constexpr (std::is_base_of_v<OnePointFitFieldBase, PassType>)
+                    fit->pointId = unsigned(m_dataMgr->storageId(int(params.fitting.pointId)));
+                if constexpr (std::is_base_of_v<CompareFitsField, PassType>) {
+                    fit->layout = params.fitting.compareLayout == "difference" ? CompareFitsField::DIFFERENCE
+                                                                               : CompareFitsField::GRID;
+                    fit->first = params.fitting.comparePair[0];
+                    fit->second = params.fitting.comparePair[1];
+                }
+                if constexpr (std::is_base_of_v<CostFieldBase, PassType>) {
+                    for (size_t m = 0; m != CostFieldBase::metricNames.size(); ++m)
+                        if (CostFieldBase::metricNames[m] == params.fitting.costMetric)
+                            fit->metric = CostFieldBase::Metric(m);
+                }
+            });
+            m_dataMgr->setGridCellSize(params.fitting.scale);
+            m_dataMgr->setLevelOfDetail(params.performance.levelOfDetail);
+            m_dataMgr->setSpatialIndex(params.fitting.index == "grid" ? DataManager::UNIFORM_GRID
+                                                                      : DataManager::KDTREE);
+            m_dataMgr->prepareSpatialIndex();
 
             // configure renderer
             std::cout << "Configure renderer" << std::endl;
@@ -140,20 +665,235 @@ namespace poncaplot {
                     new FillPass({1, 1, 1, 1}), pass, new ColorMap({1, 1, 1, 1})
 //                , new DisplayPoint({0,0,0,1})
             };
+            const int channel = FieldBuffer::channelIndex(params.fitting.channel);
+            static_cast<ColorMap *>(renderPasses[2])->m_channel = channel;
+
+            if (!params.validation.mode.empty()) {
+                m_exitCode = validate(passId, params.validation.mode == "lod", params.validation.thresholds,
+                                      params.output.width, params.output.height) ? 0 : 1;
+                return skipGUI;
+            }
+
+            if (params.fitting.scaleRange) {
+                ScaleSweepExport::Settings settings;
+                settings.scaleStart    = (*params.fitting.scaleRange)[0];
+                settings.scaleEnd      = (*params.fitting.scaleRange)[1];
+                settings.scaleStep     = (*params.fitting.scaleRange)[2];
+                settings.outputPattern = params.output.path;
+                settings.width         = params.output.width;
+                settings.height        = params.output.height;
+                settings.nbThreads     = unsigned(std::max(0, params.performance.threads));
+                settings.schedule      = m_schedule;
+                settings.fitPassId     = passId;
+                settings.channel       = channel;
+
+                ScaleSweepExport job;
+                job.start(*m_dataMgr, [&renderPasses, passId]() {
+                    ScaleSweepExport::PassSet set;
+                    set.passes.emplace_back(new FillPass(*static_cast<FillPass *>(renderPasses[0])));
+                    set.fit = set.passes.emplace_back(DrawingPassRegistry::clone(passId, renderPasses[1])).get();
+                    set.passes.emplace_back(new ColorMap(*static_cast<ColorMap *>(renderPasses[2])));
+                    return set;
+                }, settings);
+                job.wait();
+                if (job.failedFrameCount() != 0) m_exitCode = 1;
+                return skipGUI;
+            }
+
+            if (!params.sequence.empty()) {
+                renderSequence(params.sequence, params.output.path, renderPasses,
+                               params.output.width, params.output.height);
+                return skipGUI;
+            }
 
             // render
+            auto texture = new float[params.output.width * params.output.height * 4];
             std::cout << "Render" << std::endl;
-            const auto &points = m_dataMgr->getKdTree();
+            RenderingContext ctx {params.output.width, params.output.height, 1.f, nullptr}; // grid: see renderPass
+            ctx.schedule = m_schedule;
+            ctx.x0 = params.output.x0;
+            ctx.y0 = params.output.y0;
+            const KdTree *tree = &m_dataMgr->getKdTree();
+            if (tiles.isOpen()) {
+                // only the points that can be reached by the fits of the region
+                const float margin = params.fitting.scale;
+                const auto lo = ctx.pixToPoint(0, 0);
+                const auto hi = ctx.pixToPoint(int(ctx.w), int(ctx.h));
+                tree = &tiles.region({DataPoint::VectorType(lo.first - margin, lo.second - margin),
+                                      DataPoint::VectorType(hi.first + margin, hi.second + margin)});
+                std::cout << "Loaded " << tree->point_count() << " points of " << tiles.pointCount() << std::endl;
+            }
+            const auto &points = *tree;
+            FieldBuffer fields;
+            const unsigned int channels = params.output.fieldChannels | (channel >= 0 ? 1u << channel : 0u);
+            if (channels != 0) {
+                fields.resize(ctx.w, ctx.h, channels);
+                ctx.fields = &fields;
+            }
             for (auto *p: renderPasses) {
-                p->render(points, texture, {params.output.width, params.output.height});
+                // the raw field is saved before being colormapped
+                if (p == renderPasses[2] && !params.output.fieldPath.empty()) {
+                    std::cout << "Save field" << std::endl;
+                    if (!write_field(int(ctx.w), int(ctx.h), texture, ctx.fields, params.output.fieldPath,
+                                     params.output.fieldChannels))
+                        std::cerr << "Cannot save field to " << params.output.fieldPath << std::endl;
+                }
+                if (p == pass && !tiles.isOpen()) m_dataMgr->renderPass(passId, texture, ctx);
+                else p->render(points, texture, ctx);
             }
+            if (const auto *cost = dynamic_cast<const CostFieldBase *>(pass))
+                std::cout << "Total cost (" << CostFieldBase::metricNames[cost->metric] << "): " << cost->lastTotal
+                          << std::endl;
 
-            std::cout << "Save image" << std::endl;
-            write_image(params.output.width, params.output.height, texture, params.output.path);
+            if (!params.output.path.empty()) {
+                std::cout << "Save image" << std::endl;
+                write_image(params.output.width, params.output.height, texture, params.output.path);
+            }
 
             delete[] texture;
         }
 
         return skipGUI;
     }
+
+    bool
+    PoncaPlotCLI::validate(size_t passId, bool levelOfDetail, const ValidationThresholds &thresholds,
+                           size_t width, size_t height) {
+        FillPass fill({1, 1, 1, 1});
+        RenderingContext ctx{width, height, 1.f, nullptr};
+        ctx.schedule = m_schedule;
+        const auto spatialIndex = m_dataMgr->getSpatialIndex();
+        const bool lodEnabled = m_dataMgr->isLevelOfDetailEnabled();
+        float scale = 1.f;
+        m_dataMgr->processPass(passId, [&scale](auto *p) {
+            if constexpr (std::is_base_of_v<BaseFitField, std::remove_pointer_t<decltype(p)>>)
+                scale = p->params.m_scale;
+        });
+
+        // reference: kd-tree on the full resolution cloud. Candidate: the approximate mode only
+        const auto render = [&](bool candidate, std::vector<float> &texture) {
+            m_dataMgr->setLevelOfDetail(candidate && levelOfDetail);
+            m_dataMgr->setSpatialIndex(candidate && !levelOfDetail ? DataManager::UNIFORM_GRID
+                                                                   : DataManager::KDTREE);
+            m_dataMgr->prepareSpatialIndex();
+            texture.resize(width * height * 4);
+            fill.render(m_dataMgr->getKdTree(), texture.data(), ctx);
+            // the first render builds the levels of detail of the mode: only the second one is timed
+            m_dataMgr->renderPass(passId, texture.data(), ctx);
+            fill.render(m_dataMgr->getKdTree(), texture.data(), ctx);
+            const auto start = std::chrono::steady_clock::now();
+            m_dataMgr->renderPass(passId, texture.data(), ctx);
+            return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        };
+        std::vector<float> reference, candidate;
+        const double referenceMs = render(false, reference);
+        const double candidateMs = render(true, candidate);
+        const size_t level = m_dataMgr->getLevelOfDetail(scale);
+        m_dataMgr->setLevelOfDetail(lodEnabled);
+        m_dataMgr->setSpatialIndex(spatialIndex);
+        m_dataMgr->prepareSpatialIndex();
+
+        std::cout << "Validation of " << DataManager::supportedDrawingPasses[passId] << " ("
+                  << (levelOfDetail ? "level of detail" : "uniform grid") << " vs exact)\n";
+        if (levelOfDetail) {
+            std::cout << "  level of detail: " << level << " (base spacing " << m_dataMgr->getLevelOfDetailSpacing()
+                      << ")\n";
+            // the candidate would be the exact render: nothing is validated
+            if (level == 0) {
+                std::cout << "  the full resolution cloud is used at scale " << scale
+                          << ": increase the scale (-s) to validate a level of detail\nFAILED" << std::endl;
+                return false;
+            }
+        }
+        std::cout << "  exact: " << referenceMs << " ms, approximate: " << candidateMs << " ms, speedup: "
+                  << referenceMs / candidateMs << "\n";
+        const bool ok = checkFields(compareFields(width, height, reference.data(), candidate.data()), thresholds,
+                                    scale, width * height, std::cout);
+        std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+        return ok;
+    }
+
+    void
+    PoncaPlotCLI::renderSequence(const std::vector<std::string> &frames, const std::string &outputPattern,
+                                 const std::array<DrawingPass *, 3> &passes, size_t width, size_t height) const {
+        // Frames in flight: one being loaded, one waiting, one being rendered. Each frame owns its point container
+        // and spatial index, that are reused (not reallocated) when the next frame is loaded.
+        constexpr size_t nbFrames = 3;
+        // Textures in flight: one being rendered, one being encoded
+        constexpr size_t nbTextures = 2;
+
+        using Frame = std::pair<size_t, DataManager *>; // frame number, data
+        using Image = std::pair<size_t, float *>;       // frame number, texture
+
+        std::array<std::unique_ptr<DataManager>, nbFrames> frameData;
+        BoundedQueue<DataManager *> freeFrames(nbFrames);
+        for (auto &data: frameData) {
+            data = std::make_unique<DataManager>();
+            data->setSpatialIndex(m_dataMgr->getSpatialIndex());
+            data->setGridCellSize(m_dataMgr->getGridCellSize());
+            freeFrames.push(data.get());
+        }
+
+        std::vector<std::vector<float>> textures(nbTextures, std::vector<float>(width * height * 4));
+        BoundedQueue<float *> freeTextures(nbTextures);
+        for (auto &t: textures) freeTextures.push(t.data());
+
+        BoundedQueue<Frame> loadedFrames(1);
+        BoundedQueue<Image> renderedImages(1);
+
+        std::cout << "Render sequence of " << frames.size() << " frames" << std::endl;
+        const auto start = std::chrono::steady_clock::now();
+
+        // stage 1: load and index
+        std::thread loader([&frames, &freeFrames, &loadedFrames]() {
+            for (size_t k = 0; k != frames.size(); ++k) {
+                auto data = freeFrames.pop();
+                if (!data) break;
+                if ((*data)->loadPointCloud(frames[k])) {
+                    (*data)->prepareSpatialIndex();
+                    loadedFrames.push({k, *data});
+                } else {
+                    std::cerr << "Skipping frame " << k << ": cannot load " << frames[k] << std::endl;
+                    freeFrames.push(*data);
+                }
+            }
+            loadedFrames.close();
+        });
+
+        // stage 3: encode
+        std::thread encoder([&outputPattern, width, height, &renderedImages, &freeTextures]() {
+            std::vector<char> buffer;
+            while (auto image = renderedImages.pop()) {
+                const auto path = formatFramePath(outputPattern, image->first);
+                write_image(int(width), int(height), image->second, path, buffer);
+                std::cout << "Saved " << path << std::endl;
+                freeTextures.push(image->second);
+            }
+        });
+
+        // stage 2: render, on the calling thread (passes are not thread-safe, and use OpenMP internally)
+        const int channel = static_cast<ColorMap *>(passes[2])->m_channel;
+        FieldBuffer fields;
+        while (auto frame = loadedFrames.pop()) {
+            auto texture = freeTextures.pop();
+            const auto *data = frame->second;
+            RenderingContext ctx {width, height, 1.f, data->getActiveGrid()};
+            ctx.schedule = m_schedule;
+            if (channel >= 0) {
+                fields.resize(width, height, 1u << channel);
+                ctx.fields = &fields;
+            }
+            for (auto *p: passes)
+                p->render(data->getKdTree(), *texture, ctx);
+            freeFrames.push(frame->second);
+            renderedImages.push({frame->first, *texture});
+        }
+        renderedImages.close();
+
+        loader.join();
+        encoder.join();
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << "Rendered " << frames.size() << " frames in " << elapsed.count() << "s" << std::endl;
+    }
 }
@@ -1,7 +1,15 @@
 #pragma once
 
+#include "contexts.h"
+#include "fieldValidation.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
 // forward declarations
 class DataManager;
+struct DrawingPass;
 
 namespace poncaplot {
     class PoncaPlotCLI {
@@ -11,8 +19,25 @@ namespace poncaplot {
 
         bool run(int argc, char **argv);
 
+        /// Exit status of the last run: non-zero if a validation failed
+        [[nodiscard]] inline int exitCode() const { return m_exitCode; }
+
     private:
+        /// Render one image per input file, with a three-stage pipeline running on separate threads:
+        /// load and index frame k+2, render frame k+1, encode frame k.
+        /// \param outputPattern printf-like pattern used to name the images from the frame number (e.g. out_%04d.png)
+        void renderSequence(const std::vector<std::string> &frames, const std::string &outputPattern,
+                            const std::array<DrawingPass *, 3> &passes, size_t width, size_t height) const;
+
+        /// Render a pass exactly and with an approximate mode, and compare the fields (see #compareFields)
+        /// \param levelOfDetail approximate mode: levels of detail if true, uniform grid otherwise
+        /// \return true if the thresholds are met. Fails if the scale of the pass is too small to use a level of detail
+        bool validate(size_t passId, bool levelOfDetail, const ValidationThresholds &thresholds,
+                      size_t width, size_t height);
+
         float *m_texture{nullptr};
+        RenderingContext::Schedule m_schedule{RenderingContext::COST_AWARE};
         DataManager *m_dataMgr{nullptr};
+        int m_exitCode{0};
     };
 }
@@ -4,28 +4,52 @@
 
 #pragma once
 
+#include <array>
+#include <string_view>
+#include <utility> //pair
+
+class UniformGrid;
+struct FieldBuffer;
+
 struct RenderingContext {
+    /// Distribution of the image tiles between the threads of the fit passes, see #forEachPixel
+    enum Schedule: int {
+        STATIC,     ///< same number of tiles per thread
+        DYNAMIC,    ///< tiles are taken by idle threads, in raster order
+        COST_AWARE  ///< tiles are taken by idle threads, most expensive first (estimated from the point density)
+    };
+    static constexpr std::array<std::string_view, 3> scheduleNames {"static", "dynamic", "cost"};
+
     size_t w {0};
     size_t h {0};
     /// Scale factor applied to the point coordinates
     float scale {1};
+    /// Optional spatial index used by fit passes for range queries, instead of the kd-tree
+    const UniformGrid* grid {nullptr};
+    /// Optional multi-channel output, filled by the fit passes in addition to the texture. Must be w x h
+    FieldBuffer* fields {nullptr};
+    /// Distribution of the pixels of the fit passes between the threads
+    Schedule schedule {COST_AWARE};
+    /// Point-space coordinates of the pixel (0,0)
+    float x0 {0};
+    float y0 {0};
 
     /// Convert distance from pixel to point space
     [[nodiscard]] inline float pixToPoint(int i) const
     { return this->scale * i;}
     /// Convert texture pixel coordinate to point space coordinage
     [[nodiscard]] inline std::pair<float, float>pixToPoint(int i, int j) const
-    { return {pixToPoint(i), pixToPoint(j)};}
+    { return {x0 + pixToPoint(i), y0 + pixToPoint(j)};}
     /// Convert distance from point to pixel space
     [[nodiscard]] inline int pointToPix(float x) const
     { return x / this->scale;}
     /// Convert point coordinates to the texture pixel space
     [[nodiscard]] inline std::pair<int, int>pointToPix(float x, float y) const
-    { return {pointToPix(x), pointToPix(y)};}
+    { return {pointToPix(x - x0), pointToPix(y - y0)};}
     /// Convert point coordinates to the texture pixel space
     template<typename vec2>
     [[nodiscard]] inline std::pair<int, int>pointToPix(vec2 p) const
-    { return {pointToPix(p.x()), pointToPix(p.y())};}
+    { return pointToPix(p.x(), p.y());}
 
 };
 
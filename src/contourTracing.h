@@ -0,0 +1,158 @@
+#pragma once
+
+#include "drawingPass.h" // FitParameters
+#include "poncaTypes.h"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+using Polyline = std::vector<DataPoint::VectorType>;
+
+/// Trace the zero-isocontour of a signed MLS field (see #IsSignedFitField), without evaluating it on a grid
+///
+/// Curves are seeded at the input points, projected onto the zero set, and followed in both directions with a
+/// predictor-corrector scheme: a step of length step along the tangent, then Newton iterations along the gradient
+/// until the potential is below a hundredth of step. Fits are only evaluated along the curve, so the cost grows with
+/// the length of the contour instead of the image area.
+///
+/// A curve stops when the fit becomes unstable, when the corrector does not converge, when it meets a part of the
+/// contour already traced, or when it closes.
+template <typename FitType, typename PostProcess>
+class ContourTracer {
+public:
+    using VectorType = DataPoint::VectorType;
+
+    inline ContourTracer(const KdTree& points, const FitParameters& params, float step)
+    : m_points(points), m_params(params), m_step(step) {}
+
+    /// Trace the contours reachable from the input points
+    inline std::vector<Polyline> trace() {
+        std::vector<Polyline> curves;
+        m_visited.clear();
+        for (const auto& p : m_points.points()) {
+            if (isVisited(p.pos())) continue;
+            auto start = projectOnContour(p.pos());
+            if (! start || isVisited(*start)) continue;
+
+            Polyline forward {*start};
+            const bool closed = follow(forward, 1.f);
+            if (! closed) {
+                Polyline backward {*start};
+                follow(backward, -1.f);
+                forward.insert(forward.begin(), backward.rbegin(), backward.rend() - 1);
+            }
+            for (const auto& x : forward) markVisited(x);
+            if (forward.size() > 1) curves.push_back(std::move(forward));
+        }
+        return curves;
+    }
+
+private:
+    struct Evaluation {
+        float potential;
+        VectorType gradient;
+    };
+
+    /// Evaluate the field at x, as #FitField does for a pixel
+    inline std::optional<Evaluation> evaluate(const VectorType& x) const {
+        VectorType query = x;
+        FitType fit;
+        fit.setWeightFunc({query, m_params.m_scale});
+        for (int iter = 0; iter != m_params.m_iter; ++iter) {
+            fit.init();
+            if (fit.computeWithIds(m_points.range_neighbors(query, m_params.m_scale), m_points.points())
+                == Ponca::STABLE)
+                query = fit.project(query);
+        }
+        if (! fit.isStable()) return std::nullopt;
+        PostProcess::apply(fit);
+        if (! fit.isSigned()) return std::nullopt; // unsigned fields have no zero crossing to follow
+        const VectorType g = fit.primitiveGradient(x);
+        if (g.squaredNorm() == 0) return std::nullopt;
+        return Evaluation{float(fit.potential(x)), g};
+    }
+
+    /// Newton iterations along the gradient
+    inline std::optional<VectorType> projectOnContour(VectorType x) const {
+        const float tolerance = 0.01f * m_step;
+        for (int k = 0; k != 10; ++k) {
+            const auto e = evaluate(x);
+            if (! e) return std::nullopt;
+            if (std::abs(e->potential) < tolerance) return x;
+            x -= e->potential / e->gradient.squaredNorm() * e->gradient;
+        }
+        return std::nullopt;
+    }
+
+    /// Extend curve from its last point, in the direction given by the sign of the tangent
+    /// \return true if the curve is closed
+    inline bool follow(Polyline& curve, float direction) {
+        constexpr int maxSteps = 1000000;
+        const VectorType start = curve.front();
+        VectorType previousTangent = VectorType::Zero();
+        for (int s = 0; s != maxSteps; ++s) {
+            const VectorType x = curve.back();
+            const auto e = evaluate(x);
+            if (! e) return false;
+            VectorType t = direction * VectorType(-e->gradient.y(), e->gradient.x()).normalized();
+            if (t.dot(previousTangent) < 0) t = -t; // keep going the same way
+            previousTangent = t;
+
+            const auto next = projectOnContour(x + m_step * t);
+            if (! next || (*next - x).norm() < 0.1f * m_step) return false;
+            if (s > 2 && (*next - start).norm() < m_step) {
+                curve.push_back(start);
+                return true;
+            }
+            if (isVisited(*next)) return false;
+            curve.push_back(*next);
+        }
+        return false;
+    }
+
+    /// Traced curves are stored in a sparse grid of cell size step
+    inline std::int64_t cellKey(const VectorType& x, int di = 0, int dj = 0) const {
+        const auto i = std::int64_t(std::floor(x.x() / m_step)) + di;
+        const auto j = std::int64_t(std::floor(x.y() / m_step)) + dj;
+        return std::int64_t((std::uint64_t(i) << 32) ^ std::uint32_t(j));
+    }
+    /// Mark the neighborhood of a curve sample: samples are step apart, so the curve may cross the neighbor cells
+    inline void markVisited(const VectorType& x) {
+        for (int dj = -1; dj <= 1; ++dj)
+            for (int di = -1; di <= 1; ++di)
+                m_visited.insert(cellKey(x, di, dj));
+    }
+    inline bool isVisited(const VectorType& x) const { return m_visited.count(cellKey(x)) != 0; }
+
+    const KdTree& m_points;
+    FitParameters m_params;
+    float m_step;
+    std::unordered_set<std::int64_t> m_visited;
+};
+
+/// Save polylines as CSV (`curve_id,x,y`) if path ends with .csv, as SVG otherwise
+/// \param w,h size of the SVG canvas
+inline bool writePolylines(const std::vector<Polyline>& curves, const std::string& path, size_t w, size_t h) {
+    std::ofstream out (path);
+    if (! out.is_open()) return false;
+    if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0) {
+        out << "curve_id,x,y\n";
+        for (size_t c = 0; c != curves.size(); ++c)
+            for (const auto& x : curves[c]) out << c << ',' << x.x() << ',' << x.y() << '\n';
+    } else {
+        out << "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" << w << "\" height=\"" << h
+            << "\" viewBox=\"0 0 " << w << ' ' << h << "\">\n";
+        for (const auto& curve : curves) {
+            out << "  <polyline fill=\"none\" stroke=\"black\" stroke-width=\"1\" points=\"";
+            for (const auto& x : curve) out << x.x() << ',' << x.y() << ' ';
+            out << "\"/>\n";
+        }
+        out << "</svg>\n";
+    }
+    return bool(out);
+}
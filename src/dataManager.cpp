@@ -1,10 +1,20 @@
 #include "dataManager.h"
 
+#include <algorithm> // min_element
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
 
 DataManager::DataManager() {
     m_drawingPasses.fill(nullptr);
+    m_tree.set_min_cell_size(typename KdTree::LeafSizeType(defaultLeafSize));
 }
 
 DataManager::~DataManager() {
@@ -22,7 +32,9 @@ DataManager::savePointCloud(const std::string& path) const{
     if( ! file.is_open() ) return false;
 
     file << "# x y nx ny " << "\n";
-    for( const auto & p : m_tree.points() ){
+    // in original order, see reorderPoints
+    for( int i = 0; i != int(m_tree.point_count()); ++i ){
+        const auto & p = m_tree.points()[storageId(i)];
         file << p.pos().transpose() << " " << p.normal().transpose() << "\n";
     }
     file.close();
@@ -38,6 +50,8 @@ DataManager::loadPointCloud(const std::string& path){
     if( ! file.is_open() ) return false;
 
     m_points.clear();
+    m_storageIds.clear();
+    m_originalIds.clear();
 
     std::string line;
     std::vector<float> numbers;
@@ -57,16 +71,19 @@ DataManager::loadPointCloud(const std::string& path){
             numbers.assign(std::istream_iterator<float>(is), std::istream_iterator<float>());
 
             if (numbers.size() == 2){ // loaded x-y only, set normal to default value
-                m_points.emplace_back(numbers[0], numbers[1], DEFAULT_POINT_ANGLE);
+                m_points.push_back(makePoint(numbers[0], numbers[1], DEFAULT_POINT_ANGLE));
                 needToComputeNormals = true;
             } else if (numbers.size() == 4){ // loaded x-y only, set normal to default value
-                m_points.emplace_back(numbers[0], numbers[1], std::atan2(numbers[3], numbers[2]));
+                m_points.push_back(makePoint(numbers[0], numbers[1], std::atan2(numbers[3], numbers[2])));
             } else { // malformed line
                 std::cerr << "Skipping malformed line: ["  << line << "]" << std::endl;
             }
         }
     }
     file.close();
+    // optional, the tuning of the previous cloud does not apply to this one
+    m_tree.set_min_cell_size(typename KdTree::LeafSizeType(defaultLeafSize));
+    loadTuning(tuningPath(path));
     updateKdTree();
 
     // Use plane fit to compute unoriented normals. Use knn and constant weights
@@ -90,7 +107,7 @@ DataManager::computeNormals(int k){
         fit.init();
         // Fit plane (method compute handles multipass fitting
         if (fit.computeWithIds(m_tree.k_nearest_neighbors(p, k), m_tree.points()) == Ponca::STABLE) {
-            pp.z() = std::acos(fit.primitiveGradient().normalized().x());
+            pp.tail<2>() = fit.primitiveGradient().normalized();
         } else
             std::cerr << "Something weird happened here..." << std::endl;
     }
@@ -115,41 +132,198 @@ DataManager::fitPointCloudToRange(const std::pair<float,float>& rangesEnd, const
     }
 }
 
-DrawingPass*
-DataManager::getDrawingPass(const std::string& name){
-    return getDrawingPass(supportedDrawingPasses.at(name));
+void
+DataManager::reorderPoints() {
+    if (m_points.empty()) return;
+    // the leaves cover contiguous ranges of the samples: use them as the new storage order
+    const auto& order = m_tree.samples();
+    PointContainer points;
+    points.reserve(m_points.size());
+    std::vector<int> originalIds (m_points.size());
+    for (size_t k = 0; k != order.size(); ++k) {
+        points.push_back(m_points[size_t(order[k])]);
+        originalIds[k] = originalId(int(order[k]));
+    }
+    m_points.swap(points);
+    m_originalIds.swap(originalIds);
+    m_storageIds.resize(m_originalIds.size());
+    for (size_t k = 0; k != m_originalIds.size(); ++k)
+        m_storageIds[size_t(m_originalIds[k])] = int(k);
+    updateKdTree();
+}
+
+std::vector<DataManager::LeafSizeTiming>
+DataManager::tuneLeafSize(float scale, size_t nbQueries) {
+    std::vector<LeafSizeTiming> timings;
+    if (m_points.empty()) return timings;
+
+    // same queries for all the leaf sizes
+    std::mt19937 gen (42);
+    std::uniform_int_distribution<size_t> pick (0, m_points.size() - 1);
+    std::uniform_real_distribution<float> jitter (-0.5f * scale, 0.5f * scale);
+    std::vector<VectorType> queries (nbQueries);
+    for (auto& q : queries) {
+        const auto& p = m_points[pick(gen)];
+        q = VectorType(p.x() + jitter(gen), p.y() + jitter(gen));
+    }
+
+    constexpr std::array<int, 7> leafSizes {4, 8, 16, 32, 64, 128, 256};
+    for (int leafSize : leafSizes) {
+        m_tree.set_min_cell_size(typename KdTree::LeafSizeType(leafSize));
+        m_tree.build(m_points);
+        // best of 3, to be robust to the noise of the other processes
+        double best = std::numeric_limits<double>::max();
+        for (int run = 0; run != 3; ++run) {
+            VectorType sum = VectorType::Zero();
+            const auto start = std::chrono::steady_clock::now();
+            for (const auto& q : queries)
+                for (int id : m_tree.range_neighbors(q, scale))
+                    sum += m_tree.points()[id].pos();
+            const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+            [[maybe_unused]] volatile float sink = sum.sum(); // keeps the neighbor reads from being optimized out
+            best = std::min(best, elapsed.count());
+        }
+        timings.push_back({leafSize, best});
+    }
+
+    const auto fastest = std::min_element(timings.begin(), timings.end(),
+                                          [](const auto& a, const auto& b) { return a.ms < b.ms; });
+    setLeafSize(fastest->leafSize); // also rebuilds the grid and levels of detail
+    return timings;
+}
+
+bool
+DataManager::saveTuning(const std::string& path) const {
+    std::ofstream file (path);
+    if (! file.is_open()) return false;
+    file << "leaf_size " << getLeafSize() << "\n";
+    return bool(file);
 }
 
+bool
+DataManager::loadTuning(const std::string& path) {
+    std::ifstream file (path);
+    if (! file.is_open()) return false;
+    std::string key;
+    int value;
+    while (file >> key >> value) {
+        if (key != "leaf_size")
+            std::cerr << "Ignoring unknown tuning parameter " << key << " in " << path << std::endl;
+        else if (value <= 0)
+            std::cerr << "Ignoring invalid leaf_size " << value << " in " << path << std::endl;
+        else
+            m_tree.set_min_cell_size(typename KdTree::LeafSizeType(value));
+    }
+    return true;
+}
 
-#define WRITE_NEW_FIT_CASE(ID,FTYPE) \
-    case ID:                     \
-        *p = new FTYPE();\
-        break;
+size_t
+DataManager::getLevelOfDetail(float scale) {
+    if (! m_useLod || m_points.empty()) return 0;
+    const float maxSpacing = m_lodFraction * scale;
+    size_t level = 0;
+    const float baseSpacing = getLevelOfDetailSpacing();
+    if (baseSpacing <= 0.f) return 0; // single point
+    while (baseSpacing * float(1u << level) <= maxSpacing) { // spacing of level + 1
+        if (level == m_lodLevels.size() && (m_lodComplete || ! buildNextLevelOfDetail())) break;
+        ++level;
+    }
+    return level;
+}
+
+void
+DataManager::renderPass(size_t passId, float* buffer, RenderingContext ctx) {
+    assert(isKdTreeUpToDate());
+    processPass(passId, [this, buffer, &ctx](auto* pass) {
+        using PassType = std::remove_pointer_t<decltype(pass)>;
+        size_t level = 0;
+        // single point fits refer to a point of the full resolution cloud
+        if constexpr (std::is_base_of_v<BaseFitField, PassType> && ! std::is_base_of_v<OnePointFitFieldBase, PassType>)
+            level = getLevelOfDetail(pass->params.m_scale);
+        // the grid indexes the full resolution cloud
+        ctx.grid = level == 0 ? getActiveGrid() : nullptr;
+        pass->render(level == 0 ? m_tree : m_lodLevels[level - 1]->tree, buffer, ctx);
+    });
+}
+
+float
+DataManager::getLevelOfDetailSpacing() {
+    if (m_lodBaseSpacing > 0.f || m_points.size() < 2) return m_lodBaseSpacing;
+    constexpr size_t maxSamples = 1024;
+    const size_t step = std::max<size_t>(1, m_points.size() / maxSamples);
+    std::vector<float> distances;
+    for (size_t i = 0; i < m_points.size(); i += step) {
+        const auto p = m_tree.points()[i].pos();
+        for (int j : m_tree.k_nearest_neighbors(int(i), 1))
+            distances.push_back((m_tree.points()[j].pos() - p).norm());
+    }
+    if (distances.empty()) return m_lodBaseSpacing;
+    auto median = distances.begin() + std::ptrdiff_t(distances.size() / 2);
+    std::nth_element(distances.begin(), median, distances.end());
+    // duplicated points would give a null spacing
+    m_lodBaseSpacing = 2.f * std::max(*median, std::numeric_limits<float>::epsilon());
+    return m_lodBaseSpacing;
+}
+
+bool
+DataManager::buildNextLevelOfDetail() {
+    const size_t level = m_lodLevels.size() + 1;
+    const float spacing = getLevelOfDetailSpacing() * float(1u << (level - 1));
+    const size_t previousSize = level == 1 ? m_points.size() : m_lodLevels.back()->points.size();
+
+    struct Cell { Eigen::Vector2f sumP {0, 0}; Eigen::Vector2f sumN {0, 0}; int count {0}; };
+    std::unordered_map<std::int64_t, size_t> cellIds;
+    std::vector<Cell> cells;
+    for (const auto& p : m_points) {
+        const auto ci = std::int64_t(std::floor(p.x() / spacing));
+        const auto cj = std::int64_t(std::floor(p.y() / spacing));
+        const auto key = std::int64_t((std::uint64_t(ci) << 32) ^ std::uint32_t(cj));
+        const auto [it, inserted] = cellIds.try_emplace(key, cells.size());
+        if (inserted) cells.emplace_back();
+        auto& c = cells[it->second];
+        Eigen::Vector2f n = p.tail<2>();
+        // normals may be unoriented: align them with the ones already in the cell before averaging
+        if (c.count != 0 && n.dot(c.sumN) < 0) n = -n;
+        c.sumP += p.head<2>();
+        c.sumN += n;
+        ++c.count;
+    }
+    if (cells.size() >= previousSize) {
+        m_lodComplete = true;
+        return false;
+    }
+
+    auto lod = std::make_unique<LodLevel>();
+    lod->points.reserve(cells.size());
+    for (const auto& c : cells) {
+        const Eigen::Vector2f n = c.sumN.squaredNorm() > 0 ? c.sumN.normalized() : Eigen::Vector2f(0, 1);
+        const Eigen::Vector2f p = c.sumP / float(c.count);
+        lod->points.push_back({PointRecord(p.x(), p.y(), n.x(), n.y()), float(c.count)});
+    }
+    lod->tree.build(lod->points);
+    m_lodComplete = cells.size() == 1;
+    m_lodLevels.push_back(std::move(lod));
+    return true;
+}
+
+size_t
+DataManager::getDrawingPassIndex(std::string_view name){
+    for (size_t i = 0; i != nbSupportedDrawingPasses; ++i)
+        if (supportedDrawingPasses[i] == name) return i;
+    throw std::out_of_range("Unknown drawing pass: " + std::string(name));
+}
+
+DrawingPass*
+DataManager::getDrawingPass(const std::string& name){
+    return getDrawingPass(getDrawingPassIndex(name));
+}
 
 DrawingPass*
 DataManager::getDrawingPass(size_t index){
     if (index >= nbSupportedDrawingPasses) return nullptr;
 
     DrawingPass** p = &(m_drawingPasses[index]);
-    if((*p) == nullptr) {
-        switch (index) {
-            WRITE_NEW_FIT_CASE(0,DistanceFieldWithKdTree)
-            WRITE_NEW_FIT_CASE(1,PlaneFitField)
-            WRITE_NEW_FIT_CASE(2,SphereFitField)
-            WRITE_NEW_FIT_CASE(3,OrientedSphereFitField)
-            WRITE_NEW_FIT_CASE(4,UnorientedSphereFitField)
-            WRITE_NEW_FIT_CASE(5,BestPlaneFitField)
-            WRITE_NEW_FIT_CASE(6,BestSphereFitField)
-            WRITE_NEW_FIT_CASE(7,BestOrientedSphereFitField)
-            WRITE_NEW_FIT_CASE(8,OnePlaneFitField)
-            WRITE_NEW_FIT_CASE(9,OneSphereFitField)
-            WRITE_NEW_FIT_CASE(10,OneOrientedSphereFitField)
-            WRITE_NEW_FIT_CASE(11,DistanceFieldFromOnePoint)
-
-            default: throw std::runtime_error("Unknown Field type!");
-        }
-    }
+    if((*p) == nullptr)
+        *p = DrawingPassRegistry::create(index);
     return *p;
 }
-
-#undef WRITE_NEW_FIT_CASE
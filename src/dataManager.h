@@ -1,10 +1,16 @@
 #pragma once
 
-#include <map>
+#include <algorithm> // max
+#include <array>
+#include <cassert>
 #include <optional>
 #include <utility> //pair
 #include <vector>
 #include <string>
+#include <string_view>
+#include <memory>
+#include <type_traits>
+#include <cmath>
 #include <iostream>
 
 #include <nanogui/vector.h>
@@ -12,9 +18,8 @@
 #include <Ponca/SpatialPartitioning>
 
 #include "poncaTypes.h"
-#include "drawingPasses/bestFieldFit.h"
-#include "drawingPasses/distanceField.h"
-#include "drawingPasses/poncaFitField.h"
+#include "uniformGrid.h"
+#include "drawingPassRegistry.h"
 
 
 #ifndef M_PI
@@ -30,28 +35,150 @@ struct DrawingPass;
 struct DataManager {
 public:
 //    using KdTree = Ponca::KdTree<DataPoint>;
-    using KdTree = Ponca::KdTreeDenseBase<Ponca::KdTreeDefaultTraits<DataPoint,MyKdTreeNode>>;
-    using PointContainer  = std::vector<nanogui::Vector3f>; // stores x,y,normal angle in radians
+    using KdTree = MyKdTreeDense<Ponca::KdTreeDefaultTraits<DataPoint,MyKdTreeNode>>;
+    /// Canonical point buffer, indexed in place by the kd-tree. Stores x,y,nx,ny with unit normals
+    using PointContainer  = std::vector<PointRecord>;
     using VectorType = typename KdTree::VectorType;
 
+    /// Spatial index used for range queries by the fit passes. The kd-tree is always available
+    enum SpatialIndexType: int {
+        KDTREE,
+        UNIFORM_GRID
+    };
+
     DataManager();
     ~DataManager();
 
     /// Read access to point collection
-    inline const KdTree& getKdTree() const { return m_tree; }
+    /// \pre The kd-tree indexes the current point container, see #isKdTreeUpToDate
+    inline const KdTree& getKdTree() const { assert(isKdTreeUpToDate()); return m_tree; }
+
+    /// Check that the point container has not been resized nor reallocated since the last #updateKdTree: the kd-tree
+    /// points to its records (see #DataPoint), that would be dangling otherwise
+    inline bool isKdTreeUpToDate() const {
+        return m_indexedSize == m_points.size() && (m_points.empty() || m_indexedData == m_points.data());
+    }
 
     /// Update point collection from point container
     inline void updateKdTree() {
         if(m_points.empty()) m_tree.clear();
         else m_tree.build(m_points );
+        m_indexedData = m_points.data();
+        m_indexedSize = m_points.size();
+        m_gridDirty = true;
+        m_lodLevels.clear();
+        m_lodComplete = false;
+        m_lodBaseSpacing = 0.f;
         m_updateFunction();
     }
 
+    /// Reorder the point container in the order of the kd-tree leaves, and rebuild the tree
+    ///
+    /// Neighbors are then close in memory, which speeds up the accumulation loops of the fits on clouds stored in
+    /// acquisition order. Points keep their original id, the index in the loaded file, for display and exports:
+    /// see #storageId and #originalId.
+    void reorderPoints();
+    /// Index in the point container of a point, given its original id. Points added after reordering keep their index
+    inline int storageId(int originalId) const
+    { return size_t(originalId) < m_storageIds.size() ? m_storageIds[size_t(originalId)] : originalId; }
+    /// Original id of the point stored at an index of the point container, see #storageId
+    inline int originalId(int storageId) const
+    { return size_t(storageId) < m_originalIds.size() ? m_originalIds[size_t(storageId)] : storageId; }
+    /// Index in the point container of each original point, empty if the points are not reordered
+    inline const std::vector<int>& getStorageIds() const { return m_storageIds; }
+
+    /// Leaf size of the kd-tree when no tuning file is loaded, see #setLeafSize
+    static constexpr int defaultLeafSize = 64;
+
+    /// Set the maximum number of points in the leaves of the kd-tree, and rebuild it
+    inline void setLeafSize(int leafSize) {
+        m_tree.set_min_cell_size(typename KdTree::LeafSizeType(std::max(1, leafSize)));
+        if (! m_points.empty()) updateKdTree();
+    }
+    inline int getLeafSize() const { return int(m_tree.min_cell_size()); }
+
+    /// Query time measured for a leaf size, see #tuneLeafSize
+    struct LeafSizeTiming {
+        int leafSize;
+        double ms;
+    };
+    /// Time the range queries of a fitting scale with several leaf sizes, and keep the fastest one
+    ///
+    /// Queries are centered around randomly picked points, and visit their neighbors as the fits do. The timings
+    /// depend on the density of the cloud relatively to the scale, so tune with the scale used for rendering.
+    /// \param nbQueries number of range queries per leaf size
+    std::vector<LeafSizeTiming> tuneLeafSize(float scale, size_t nbQueries = 4096);
+
+    /// Path of the tuning file of a point cloud, loaded with the cloud by #loadPointCloud
+    static inline std::string tuningPath(const std::string& cloudPath) { return cloudPath + ".tuning"; }
+    /// Save the tuned parameters (leaf size)
+    bool saveTuning(const std::string& path) const;
+    /// Load parameters saved by #saveTuning, without rebuilding the kd-tree. Missing parameters keep their value
+    bool loadTuning(const std::string& path);
+
+    /// Enable the levels of detail used by #renderPass. When disabled, fits are always exact
+    inline void setLevelOfDetail(bool enabled) { m_useLod = enabled; }
+    inline bool isLevelOfDetailEnabled() const { return m_useLod; }
+    /// Maximum spacing of the level of detail used for a scale, relative to the scale
+    inline void setLevelOfDetailFraction(float fraction) { m_lodFraction = fraction; }
+
+    /// Index of the level of detail used for fits at a given scale, 0 for the full resolution cloud
+    /// Level k > 0 averages the points in a grid of cell size #getLevelOfDetailSpacing * 2^(k-1), and is used when
+    /// this spacing is below the level of detail fraction of the scale.
+    /// Averaged points weigh the number of input points of their cell in the fits (see DataPoint::weight), so that
+    /// dense regions keep their influence. Renders remain approximate, and levels are disabled by default
+    /// (see #setLevelOfDetail).
+    /// \warning Coarse levels are built on demand: this is not thread-safe
+    size_t getLevelOfDetail(float scale);
+
+    /// Render a pass of the registry (see #getDrawingPass), on the level of detail matching its scale if it fits
+    /// neighborhoods (see #getLevelOfDetail)
+    /// ctx.grid is set here: the active grid for the full resolution cloud, nullptr for coarse levels
+    void renderPass(size_t passId, float* buffer, RenderingContext ctx);
+
+    /// Spacing of the first coarse level of detail, in point units: twice the median distance between the points and
+    /// their nearest neighbor, measured on a sample of the cloud
+    float getLevelOfDetailSpacing();
+
+    /// Select the spatial index used for range queries. Call #prepareSpatialIndex before rendering
+    inline void setSpatialIndex(SpatialIndexType type) { m_spatialIndex = type; }
+    inline SpatialIndexType getSpatialIndex() const { return m_spatialIndex; }
+
+    /// Set the cell size of the uniform grid, should match the fitting scale
+    /// The grid is rebuilt by the next #prepareSpatialIndex only: consecutive changes cost a single rebuild
+    inline void setGridCellSize(float cellSize) {
+        if(cellSize == m_gridCellSize) return;
+        m_gridCellSize = cellSize;
+        m_gridDirty = true;
+    }
+    inline float getGridCellSize() const { return m_gridCellSize; }
+
+    /// Build the selected spatial index if the points, the index type or the grid cell size changed since the last
+    /// call. The kd-tree is always built by #updateKdTree: this only (re)builds the uniform grid when it is selected
+    inline void prepareSpatialIndex() {
+        if(m_spatialIndex == UNIFORM_GRID && m_gridDirty) updateGrid();
+    }
+
+    /// Uniform grid to be used for range queries, nullptr if the kd-tree is selected
+    /// \pre #prepareSpatialIndex has been called since the last change of the points or of the grid parameters
+    inline const UniformGrid* getActiveGrid() const {
+        if(m_spatialIndex != UNIFORM_GRID) return nullptr;
+        assert(! m_gridDirty);
+        return &m_grid;
+    }
+
+    /// Build a point from its position and normal angle (in radians)
+    static inline PointRecord makePoint(float x, float y, float angle) {
+        return PointRecord(x, y, std::cos(angle), std::sin(angle));
+    }
+
     /// Read access to point container
     inline const PointContainer& getPointContainer() const { return m_points; }
 
     /// Read access to point container
-    /// \warning
+    /// \warning The kd-tree points to the records of this buffer: call #updateKdTree after any modification, before
+    /// using the tree. Adding or removing points invalidates the tree (checked by #getKdTree in debug builds), and
+    /// in place edits leave its bounding boxes and moments outdated
     inline PointContainer& getPointContainer() { return m_points; }
 
     /// Set Update function, called after each point update
@@ -71,22 +198,14 @@ public:
     /// \param Number of neighbors (3 means current point and 2 closest points: left and right)
     void computeNormals(int k = 3);
 
-    /// Names of the supported drawing passes
-    static constexpr size_t nbSupportedDrawingPasses = 12;
-    const std::map<const std::string, size_t> supportedDrawingPasses {
-                    {"Distance Field", 0},
-                    {"MLS - Plane", 1},
-                    {"MLS - Sphere", 2},
-                    {"MLS - Oriented Sphere", 3},
-                    {"MLS - Unoriented Sphere", 4},
-                    {"Best Fit - Plane", 5},
-                    {"Best Fit - Sphere", 6},
-                    {"Best Fit - Oriented Sphere", 7},
-                    {"One Fit - Plane", 8},
-                    {"One Fit - Sphere", 9},
-                    {"One Fit - Oriented Sphere", 10},
-                    {"One Point - Scale", 11}
-            };
+    /// Names of the supported drawing passes, indexed as #drawingPassRegistry
+    static constexpr size_t nbSupportedDrawingPasses = DrawingPassRegistry::size;
+    static constexpr std::array<std::string_view, nbSupportedDrawingPasses> supportedDrawingPasses
+            = DrawingPassRegistry::names();
+
+    /// Index of a pass in supportedDrawingPasses
+    /// \throw std::out_of_range if the name is unknown
+    static size_t getDrawingPassIndex(std::string_view name);
 
     DrawingPass* getDrawingPass(const std::string& name);
 
@@ -94,39 +213,58 @@ public:
     /// \param index of the pass name in supportedDrawingPasses
     DrawingPass* getDrawingPass(size_t index);
 
-#define WRITE_FIT_CASE(ID,FTYPE) \
-    case ID:                 \
-        f(dynamic_cast<FTYPE*>(getDrawingPass(ID))); \
-        break;
-
+    /// Call f with the drawing pass cast to its actual type
     template <typename Functor>
-    bool processPass(int index, Functor f) {
-        switch (index) {
-            WRITE_FIT_CASE(0,DistanceFieldWithKdTree)
-            WRITE_FIT_CASE(1,PlaneFitField)
-            WRITE_FIT_CASE(2,SphereFitField)
-            WRITE_FIT_CASE(3,OrientedSphereFitField)
-            WRITE_FIT_CASE(4,UnorientedSphereFitField)
-            WRITE_FIT_CASE(5,BestPlaneFitField)
-            WRITE_FIT_CASE(6,BestSphereFitField)
-            WRITE_FIT_CASE(7,BestOrientedSphereFitField)
-            WRITE_FIT_CASE(8,OnePlaneFitField)
-            WRITE_FIT_CASE(9,OneSphereFitField)
-            WRITE_FIT_CASE(10,OneOrientedSphereFitField)
-            WRITE_FIT_CASE(11,DistanceFieldFromOnePoint)
-            default: return false;
-        }
-        return true;
+    bool processPass(size_t index, Functor f) {
+        return DrawingPassRegistry::visit(index, getDrawingPass(index), f);
     }
 
-#undef WRITE_FIT_CASE
+    /// Call f on all the drawing passes deriving from Base (type selection is done at compile time)
+    template <typename Base, typename Functor>
+    void processPasses(Functor f) {
+        for (size_t i = 0; i != nbSupportedDrawingPasses; ++i)
+            processPass(i, [&f](auto* pass) {
+                if constexpr (std::is_base_of_v<Base, std::remove_pointer_t<decltype(pass)>>)
+                    f(static_cast<Base*>(pass));
+            });
+    }
 
 
 private:
+    /// Rebuild the uniform grid from the kd-tree points
+    inline void updateGrid() {
+        m_grid.build(m_tree.points(), m_gridCellSize);
+        m_gridDirty = false;
+    }
+
     PointContainer m_points;
     KdTree m_tree;
+    const PointRecord* m_indexedData {nullptr}; ///< m_points.data() when m_tree was built, see #isKdTreeUpToDate
+    size_t m_indexedSize {0};                   ///< m_points.size() when m_tree was built
+    UniformGrid m_grid;
+    SpatialIndexType m_spatialIndex {KDTREE};
+    float m_gridCellSize {40.f};
+    bool m_gridDirty {true}; ///< m_grid does not index the current points with the current cell size
     std::function<void()> m_updateFunction {[](){}};
 
+    std::vector<int> m_storageIds;  ///< see #storageId, empty if not reordered
+    std::vector<int> m_originalIds; ///< see #originalId, empty if not reordered
+
+    /// Voxel-averaged subset of the points, see #getLevelOfDetail
+    struct LodLevel {
+        std::vector<WeightedPointRecord> points;
+        KdTree tree;
+    };
+    /// Build the next level of detail from the full resolution points
+    /// \return false if it would not reduce the number of points anymore
+    bool buildNextLevelOfDetail();
+
+    bool m_useLod {false};
+    float m_lodFraction {0.1f};
+    std::vector<std::unique_ptr<LodLevel>> m_lodLevels; ///< coarse levels, built on demand. m_lodLevels[k-1] is level k
+    bool m_lodComplete {false};                         ///< true if no coarser level can be built
+    float m_lodBaseSpacing {0.f};                       ///< see #getLevelOfDetailSpacing, 0 if not measured yet
+
     std::array<DrawingPass*,nbSupportedDrawingPasses> m_drawingPasses;
 };
 
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "poncaTypes.h"
+#include "fieldBuffer.h" // signedCurvature
+
+#include <algorithm> // sort, min
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <utility>   // pair
+#include <vector>
+
+/// Fit parameters of a point at one scale
+struct PointDescriptor {
+    float nx, ny;           ///< unit normal (gradient of the primitive) at the point
+    float curvature;        ///< signed curvature, see #signedCurvature
+    float potential;        ///< potential at the point (distance to the primitive for normalized spheres)
+    float normalDeviation;  ///< 1 - |n.n'|, n' being the normal at the previous (smaller) scale. 0 for the first scale
+    std::int32_t nbNeighbors;
+    std::int32_t state;     ///< Ponca::FIT_RESULT
+};
+static_assert(sizeof(PointDescriptor) == 7 * 4, "PointDescriptor must not be padded");
+
+/// Compute the fit parameters of every point of the tree, at several scales, and stream them to a file
+///
+/// Neighbors are collected once per point in the largest ball and sorted by distance: the neighborhood of each scale
+/// is a prefix of this list. Points are processed in parallel, by blocks written as soon as they are computed.
+///
+/// Output format depends on the extension of path:
+///   - .csv: one line per point and scale: `point_id,scale,nx,ny,curvature,potential,normal_deviation,neighbors,state`
+///   - otherwise binary, little-endian: magic "PPDESC01", uint32 number of points, uint32 number of scales,
+///     float32 scales, then one #PointDescriptor per point and scale (point-major, scales in increasing order)
+///
+/// \param storageIds index in the tree of the point described by each output row (see DataManager::reorderPoints).
+///        Rows past its end use the tree order, as DataManager::storageId does for the points added after reordering
+/// \return false if the file cannot be opened or no scale is given
+template <typename FitType, typename PostProcess>
+bool computeMultiScaleDescriptors(const KdTree& tree, std::vector<float> scales, const std::string& path,
+                                  const std::vector<int>& storageIds = {}) {
+    using VectorType = typename DataPoint::VectorType;
+    using IndexType  = typename KdTree::IndexType;
+
+    if (scales.empty()) return false;
+    std::sort(scales.begin(), scales.end());
+    const float maxScale = scales.back();
+    const int nbScales = int(scales.size());
+    const int nbPoints = int(tree.point_count());
+
+    const bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+    std::ofstream out (path, csv ? std::ios::out : std::ios::out | std::ios::binary);
+    if (! out.is_open()) return false;
+
+    if (csv) {
+        out << "point_id,scale,nx,ny,curvature,potential,normal_deviation,neighbors,state\n";
+    } else {
+        const std::uint32_t header[2] {std::uint32_t(nbPoints), std::uint32_t(nbScales)};
+        out.write("PPDESC01", 8);
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(scales.data()), std::streamsize(sizeof(float) * scales.size()));
+    }
+
+    // range of ids, to fit on a prefix of the sorted neighborhood
+    struct IdRange {
+        const IndexType *b, *e;
+        inline const IndexType* begin() const { return b; }
+        inline const IndexType* end()   const { return e; }
+    };
+
+    constexpr int blockSize = 4096;
+    std::vector<PointDescriptor> block (size_t(blockSize) * nbScales);
+
+    for (int start = 0; start < nbPoints; start += blockSize) {
+        const int end = std::min(nbPoints, start + blockSize);
+
+#pragma omp parallel for schedule(dynamic, 64) default(none) shared(tree, scales, block, start, end, nbScales, maxScale, storageIds)
+        for (int i = start; i < end; ++i) {
+            // reused between the points processed by the same thread
+            thread_local std::vector<std::pair<float, IndexType>> neighbors;
+            thread_local std::vector<IndexType> ids;
+
+            const VectorType query = tree.points()[size_t(i) < storageIds.size() ? storageIds[size_t(i)] : i].pos();
+            neighbors.clear();
+            for (auto id : tree.range_neighbors(query, maxScale))
+                neighbors.emplace_back((tree.points()[id].pos() - query).squaredNorm(), id);
+            std::sort(neighbors.begin(), neighbors.end());
+            ids.resize(neighbors.size());
+            for (size_t k = 0; k != neighbors.size(); ++k) ids[k] = neighbors[k].second;
+
+            size_t count = 0;
+            VectorType prevNormal = VectorType::Zero();
+            for (int s = 0; s != nbScales; ++s) {
+                const float scale = scales[s];
+                while (count < neighbors.size() && neighbors[count].first < scale * scale) ++count;
+
+                FitType fit;
+                fit.setWeightFunc({query, scale});
+                fit.init();
+                fit.computeWithIds(IdRange{ids.data(), ids.data() + count}, tree.points());
+
+                auto& d = block[size_t(i - start) * nbScales + s];
+                d.nbNeighbors = std::int32_t(fit.getNumNeighbors());
+                d.state = std::int32_t(fit.getCurrentState());
+                if (fit.isStable()) {
+                    PostProcess::apply(fit);
+                    const VectorType n = fit.primitiveGradient(query).normalized();
+                    d.nx = n.x();
+                    d.ny = n.y();
+                    d.curvature = signedCurvature(fit);
+                    d.potential = fit.potential(query);
+                    d.normalDeviation = prevNormal.isZero() ? 0.f : 1.f - std::abs(n.dot(prevNormal));
+                    prevNormal = n;
+                } else {
+                    d.nx = d.ny = d.curvature = d.potential = d.normalDeviation
+                            = std::numeric_limits<float>::quiet_NaN();
+                }
+            }
+        }
+
+        // stream the block
+        if (csv) {
+            for (int i = start; i < end; ++i)
+                for (int s = 0; s != nbScales; ++s) {
+                    const auto& d = block[size_t(i - start) * nbScales + s];
+                    out << i << ',' << scales[s] << ',' << d.nx << ',' << d.ny << ',' << d.curvature << ','
+                        << d.potential << ',' << d.normalDeviation << ',' << d.nbNeighbors << ',' << d.state << '\n';
+                }
+        } else
+            out.write(reinterpret_cast<const char*>(block.data()),
+                      std::streamsize(sizeof(PointDescriptor) * size_t(end - start) * nbScales));
+        std::cout << "Descriptors: " << end << "/" << nbPoints << " points" << std::endl;
+    }
+    return bool(out);
+}
@@ -1,9 +1,16 @@
 #pragma once
 
+#include <algorithm> // min, max
+#include <array>
+#include <cmath>
+#include <limits>
 #include <random>
 #include <iostream>
+#include <utility> //pair
+#include <vector>
 
 #include "contexts.h"
+#include "fieldBuffer.h"
 #include "poncaTypes.h"
 
 
@@ -20,6 +27,19 @@ struct DrawingParameters {
     bool renderTrajectories {false};
 };
 
+/// Post-processing policy of the fit passes, applied to stable fits before evaluating the potential
+/// Policies are template parameters of the passes, so they are inlined in the per-pixel loops.
+struct NoPostProcess {
+    template <typename FitType>
+    static inline void apply(FitType& /*fit*/) {}
+};
+
+/// Normalize algebraic spheres so that the potential approximates the euclidean distance
+struct PrattNormPostProcess {
+    template <typename FitType>
+    static inline void apply(FitType& fit) { fit.applyPrattNorm(); }
+};
+
 /// Base class to rendering processes
 struct DrawingPass {
     virtual void render(const KdTree& points, float*buffer, RenderingContext ctx) = 0;
@@ -112,42 +132,94 @@ private:
     std::uniform_int_distribution<> distrib{1, 255};
 };
 
+/// Draw the points and their normals on top of the image
+///
+/// Points are rasterized with precomputed stamps (disk + normal stick, one stamp per normal orientation bucket), and
+/// binned into image tiles so that each thread owns the pixels of a tile. Tiles where stamps overlap too much are
+/// rendered as a point density map instead (see #m_densityThreshold).
 struct DisplayPoint : public DrawingPass {
     inline explicit DisplayPoint(const nanogui::Vector4i &pointColor = {0,0,0,1})
             : DrawingPass(), m_pointColor(pointColor) {}
     void render(const KdTree& points, float*buffer, RenderingContext ctx) override{
-        using VectorType = typename KdTree::VectorType;
+        if (points.point_count() == 0) return;
+        const int w = ctx.w;
+        const int h = ctx.h;
         const int scaledHalfSize = ctx.pointToPix(m_halfSize);
         const int pLargeSize = 2 * scaledHalfSize;
-#pragma omp parallel for default(none) shared(points, buffer, ctx, scaledHalfSize, pLargeSize)
-        for (int pid = 0; pid< points.point_count(); ++pid){
+        updateStamps(scaledHalfSize, ctx.pointToPix(1.f));
+
+        // pixel coordinates and stamp of each point
+        const int nbPoints = int(points.point_count());
+        std::vector<StampRef> refs (nbPoints);
+#pragma omp parallel for default(none) shared(points, refs, ctx, nbPoints)
+        for (int pid = 0; pid < nbPoints; ++pid) {
             const auto& p = points.points()[pid];
-            // Build vector that is orthogonal to the normal vector
-            const VectorType& tangent {p.normal().y(), -p.normal().x()};
             auto coord = ctx.pointToPix(p.pos());
-            int i (coord.first);
-            int j (coord.second);
-            for (int u =-pLargeSize; u <= pLargeSize; ++u ){
-                int ii = i+u;
-                if(ii>=0 && ii<ctx.w){
-                    for (int v = -pLargeSize; v <= pLargeSize; ++v ) {
-                        VectorType localPos {u,v};
-                        int jj = j + v;
-                        if (jj >= 0 && jj < ctx.h) {
-                            bool draw = (localPos.squaredNorm() < scaledHalfSize * scaledHalfSize)  // draw point
-                                    ||  ((localPos.squaredNorm() < pLargeSize * pLargeSize)
-                                         && (localPos.dot(p.normal()) > 0.f)
-                                         && (std::abs(localPos.dot(tangent)) < ctx.pointToPix(1.f))
-                                         ) // draw normal
-                                    ;
-                            if (draw) {
-                                auto *b = buffer + (ii + jj * ctx.w) * 4;
-                                b[0] = m_pointColor[0];
-                                b[1] = m_pointColor[1];
-                                b[2] = m_pointColor[2];
-                                b[3] = m_pointColor[3];
-                            }
-                        }
+            const float angle = std::atan2(p.normal().y(), p.normal().x());
+            int bucket = int(std::lround(angle / float(2. * EIGEN_PI) * nbOrientationBuckets)) % nbOrientationBuckets;
+            if (bucket < 0) bucket += nbOrientationBuckets;
+            refs[pid] = {coord.first, coord.second, bucket};
+        }
+
+        // bin points in all the tiles covered by their stamp (counting sort)
+        const int nbTilesX = (w + tileSize - 1) / tileSize;
+        const int nbTilesY = (h + tileSize - 1) / tileSize;
+        const int nbTiles = nbTilesX * nbTilesY;
+        auto tileRange = [=](const StampRef& r, int& tx0, int& tx1, int& ty0, int& ty1) {
+            tx0 = std::max(r.i - pLargeSize, 0) / tileSize;
+            ty0 = std::max(r.j - pLargeSize, 0) / tileSize;
+            tx1 = std::min(r.i + pLargeSize, w - 1) / tileSize;
+            ty1 = std::min(r.j + pLargeSize, h - 1) / tileSize;
+            return r.i + pLargeSize >= 0 && r.i - pLargeSize < w && r.j + pLargeSize >= 0 && r.j - pLargeSize < h;
+        };
+        std::vector<int> tileStart (nbTiles + 1, 0);
+        for (const auto& r : refs) {
+            int tx0, tx1, ty0, ty1;
+            if (! tileRange(r, tx0, tx1, ty0, ty1)) continue;
+            for (int ty = ty0; ty <= ty1; ++ty)
+                for (int tx = tx0; tx <= tx1; ++tx)
+                    ++tileStart[ty * nbTilesX + tx + 1];
+        }
+        for (int t = 0; t < nbTiles; ++t) tileStart[t + 1] += tileStart[t];
+        std::vector<StampRef> bins (tileStart.back());
+        {
+            std::vector<int> cursor (tileStart.begin(), tileStart.end() - 1);
+            for (const auto& r : refs) {
+                int tx0, tx1, ty0, ty1;
+                if (! tileRange(r, tx0, tx1, ty0, ty1)) continue;
+                for (int ty = ty0; ty <= ty1; ++ty)
+                    for (int tx = tx0; tx <= tx1; ++tx)
+                        bins[cursor[ty * nbTilesX + tx]++] = r;
+            }
+        }
+
+        // rasterize, one tile per thread
+#pragma omp parallel for schedule(dynamic) default(none) shared(buffer, bins, tileStart, nbTiles, nbTilesX, w, h)
+        for (int t = 0; t < nbTiles; ++t) {
+            const int start = tileStart[t];
+            const int end = tileStart[t + 1];
+            if (start == end) continue;
+            const int x0 = (t % nbTilesX) * tileSize;
+            const int y0 = (t / nbTilesX) * tileSize;
+            const int x1 = std::min(x0 + tileSize, w);
+            const int y1 = std::min(y0 + tileSize, h);
+
+            const float overdraw = float(end - start) * m_meanStampArea / float((x1 - x0) * (y1 - y0));
+            if (m_densityThreshold > 0.f && overdraw > m_densityThreshold) {
+                renderDensityTile(bins.data() + start, bins.data() + end, x0, y0, x1, y1, buffer, w);
+                continue;
+            }
+            for (int k = start; k != end; ++k) {
+                const auto& r = bins[k];
+                for (const auto& o : m_stamps[r.bucket]) {
+                    const int ii = r.i + o.first;
+                    const int jj = r.j + o.second;
+                    if (ii >= x0 && ii < x1 && jj >= y0 && jj < y1) {
+                        auto *b = buffer + (ii + jj * w) * 4;
+                        b[0] = m_pointColor[0];
+                        b[1] = m_pointColor[1];
+                        b[2] = m_pointColor[2];
+                        b[3] = m_pointColor[3];
                     }
                 }
             }
@@ -155,6 +227,78 @@ struct DisplayPoint : public DrawingPass {
     }
     nanogui::Vector4f m_pointColor;
     float m_halfSize{3.f};
+    /// Mean number of stamps covering a pixel of a tile above which the tile is rendered as a density map.
+    /// Set to 0 to always draw stamps
+    static constexpr float defaultDensityThreshold = 8.f;
+    float m_densityThreshold{defaultDensityThreshold};
+    /// Number of points in a pixel giving the full point color in density maps
+    float m_densitySaturation{16.f};
+
+private:
+    static constexpr int tileSize = 64;
+    static constexpr int nbOrientationBuckets = 64;
+
+    /// Pixel coordinates and orientation bucket of a point
+    struct StampRef { int i, j, bucket; };
+
+    /// Build the point + normal stamps, if needed
+    inline void updateStamps(int halfSize, int stickWidth) {
+        if (halfSize == m_stampHalfSize && stickWidth == m_stampStickWidth) return;
+        m_stampHalfSize = halfSize;
+        m_stampStickWidth = stickWidth;
+        using VectorType = typename KdTree::VectorType;
+        const int largeSize = 2 * halfSize;
+        size_t totalSize = 0;
+        for (int bucket = 0; bucket != nbOrientationBuckets; ++bucket) {
+            const float angle = float(2. * EIGEN_PI) * float(bucket) / float(nbOrientationBuckets);
+            const VectorType normal {std::cos(angle), std::sin(angle)};
+            // Build vector that is orthogonal to the normal vector
+            const VectorType tangent {normal.y(), -normal.x()};
+            auto& stamp = m_stamps[bucket];
+            stamp.clear();
+            for (int v = -largeSize; v <= largeSize; ++v) {
+                for (int u = -largeSize; u <= largeSize; ++u) {
+                    VectorType localPos {u, v};
+                    bool draw = (localPos.squaredNorm() < halfSize * halfSize)  // draw point
+                                || ((localPos.squaredNorm() < largeSize * largeSize)
+                                    && (localPos.dot(normal) > 0.f)
+                                    && (std::abs(localPos.dot(tangent)) < stickWidth)
+                                ) // draw normal
+                            ;
+                    if (draw) stamp.emplace_back(u, v);
+                }
+            }
+            totalSize += stamp.size();
+        }
+        m_meanStampArea = float(totalSize) / float(nbOrientationBuckets);
+    }
+
+    /// Blend the point color according to the number of points in each pixel of the tile [x0,x1[ x [y0,y1[
+    inline void renderDensityTile(const StampRef* begin, const StampRef* end,
+                                  int x0, int y0, int x1, int y1, float* buffer, int w) const {
+        const int tw = x1 - x0;
+        std::vector<int> counts (tw * (y1 - y0), 0);
+        for (const auto* r = begin; r != end; ++r)
+            if (r->i >= x0 && r->i < x1 && r->j >= y0 && r->j < y1)
+                ++counts[(r->i - x0) + (r->j - y0) * tw];
+
+        const float invLogSaturation = 1.f / std::log1p(m_densitySaturation);
+        for (int jj = y0; jj < y1; ++jj) {
+            for (int ii = x0; ii < x1; ++ii) {
+                const int count = counts[(ii - x0) + (jj - y0) * tw];
+                if (count == 0) continue;
+                const float alpha = std::min(1.f, std::log1p(float(count)) * invLogSaturation);
+                auto *b = buffer + (ii + jj * w) * 4;
+                for (int c = 0; c != 4; ++c)
+                    b[c] = (1.f - alpha) * b[c] + alpha * m_pointColor[c];
+            }
+        }
+    }
+
+    std::array<std::vector<std::pair<int, int>>, nbOrientationBuckets> m_stamps;
+    int m_stampHalfSize {-1};
+    int m_stampStickWidth {-1};
+    float m_meanStampArea {0.f};
 };
 
 
@@ -169,6 +313,9 @@ struct DisplayPoint : public DrawingPass {
 ///
 /// \note The recognition bit and the max values are read from the first pixel (buffer[1] and buffer[3] respectively),
 ///       and thus must be set even if the pixel is invalid
+///
+/// When #m_channel is set and a fit pass filled RenderingContext::fields, the values are read from this channel
+/// instead, normalized by their maximum absolute value (isolines are drawn in the potential channel only).
 struct ColorMap : public DrawingPass {
     inline explicit ColorMap(const nanogui::Vector4i &isoColor = {1,1,1,1},
                              const nanogui::Vector4i &defaultColor = {1,1,1,0})
@@ -179,21 +326,39 @@ struct ColorMap : public DrawingPass {
 
     void render(const KdTree& points, float*buffer, RenderingContext ctx) override{
         const FieldType ftype {int(buffer[3])};
-        const auto maxVal = buffer[1];
+        auto maxVal = buffer[1];
+        auto isoWidth = m_isoWidth;
 
         if (ftype == NO_FIELD) return;
 
-#pragma omp parallel for default(none) shared(buffer, ctx, ftype, maxVal)
+        // values read from a channel of the field buffer
+        const float* channel = nullptr;
+        if (m_channel >= 0 && ctx.fields != nullptr && ctx.fields->isWritten())
+            channel = ctx.fields->plane(FieldBuffer::Channel(m_channel));
+        if (channel != nullptr && m_channel != FieldBuffer::POTENTIAL) {
+            maxVal = 0.f;
+            for (size_t j = 0; j < ctx.w * ctx.h; ++j)
+                if (std::isfinite(channel[j])) maxVal = std::max(maxVal, std::abs(channel[j]));
+            maxVal = std::nextafter(maxVal, std::numeric_limits<float>::max()); // max value is included
+            isoWidth = 0.f;
+        }
+
+#pragma omp parallel for default(none) shared(buffer, ctx, ftype, maxVal, isoWidth, channel)
         for(auto j = 0; j<ctx.w*ctx.h; ++j){
             auto *b = buffer + j * 4;
             auto val = b[0];
+            auto valType = FieldValueType(b[2]);
+            if (channel != nullptr && valType != VALUE_IS_BORDER) {
+                val = channel[j];
+                valType = std::isfinite(val) ? VALUE_IS_VALID : VALUE_IS_INVALID;
+            }
             nanogui::Vector4f c =  m_defaultColor;
 
             switch (ftype) {
                 case SCALAR_FIELD: {
-                    switch (FieldValueType(b[2])) {
+                    switch (valType) {
                         case VALUE_IS_VALID : {
-                            if (std::abs(val) < m_isoWidth) {
+                            if (std::abs(val) < isoWidth) {
                                 c = m_isoColor;
                             } else if (std::abs(val) < maxVal) {
                                 if (val > 0.f) {
@@ -229,6 +394,8 @@ struct ColorMap : public DrawingPass {
 
     int m_isoQuantifyNumber {10};
     float m_isoWidth {0.8};
+    /// Channel of RenderingContext::fields to display (see FieldBuffer::Channel), -1 to use the texture value
+    int m_channel {-1};
     nanogui::Vector4f m_isoColor;
     nanogui::Vector4f m_defaultColor;
 
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "drawingPass.h"
+#include "drawingPasses/bestFieldFit.h"
+#include "drawingPasses/compareFitsField.h"
+#include "drawingPasses/costField.h"
+#include "drawingPasses/distanceField.h"
+#include "drawingPasses/momentFitField.h"
+#include "drawingPasses/poncaFitField.h"
+
+#include <array>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility> //index_sequence
+
+/// Entry of the drawing pass registry: pass type and display name
+template <typename _PassType>
+struct PassEntry {
+    using PassType = _PassType;
+    std::string_view name;
+};
+
+/// Drawing passes exposed in the GUI and the CLI, in display order.
+///
+/// Everything else (names, instantiation, typed dispatch) is generated from this list: adding a Ponca basket only
+/// requires a new line, e.g. `PassEntry<FitField<MyFit, PrattNormPostProcess>> {"MLS - My Fit"}`.
+inline constexpr auto drawingPassRegistry = std::make_tuple(
+        PassEntry<DistanceFieldWithKdTree>           {"Distance Field"},
+        PassEntry<PlaneFitField>                     {"MLS - Plane"},
+        PassEntry<SphereFitField>                    {"MLS - Sphere"},
+        PassEntry<OrientedSphereFitField>            {"MLS - Oriented Sphere"},
+        PassEntry<UnorientedSphereFitField>          {"MLS - Unoriented Sphere"},
+        PassEntry<BestPlaneFitField>                 {"Best Fit - Plane"},
+        PassEntry<BestSphereFitField>                {"Best Fit - Sphere"},
+        PassEntry<BestOrientedSphereFitField>        {"Best Fit - Oriented Sphere"},
+        PassEntry<OnePlaneFitField>                  {"One Fit - Plane"},
+        PassEntry<OneSphereFitField>                 {"One Fit - Sphere"},
+        PassEntry<OneOrientedSphereFitField>         {"One Fit - Oriented Sphere"},
+        PassEntry<DistanceFieldFromOnePoint>         {"One Point - Scale"},
+        PassEntry<ConstPlaneMomentFitField>          {"MLS Const - Plane"},
+        PassEntry<ConstSphereMomentFitField>         {"MLS Const - Sphere"},
+        PassEntry<ConstOrientedSphereMomentFitField> {"MLS Const - Oriented Sphere"},
+        PassEntry<PlaneCostField>                    {"Cost - Plane"},
+        PassEntry<SphereCostField>                   {"Cost - Sphere"},
+        PassEntry<OrientedSphereCostField>           {"Cost - Oriented Sphere"},
+        PassEntry<UnorientedSphereCostField>         {"Cost - Unoriented Sphere"},
+        PassEntry<CompareFitsField>                  {"Compare - MLS fits"}
+);
+
+/// Compile-time queries on #drawingPassRegistry. Passes are identified by their index in the registry
+struct DrawingPassRegistry {
+    using Entries = std::decay_t<decltype(drawingPassRegistry)>;
+    static constexpr size_t size = std::tuple_size_v<Entries>;
+    template <size_t I>
+    using PassType = typename std::tuple_element_t<I, Entries>::PassType;
+
+    /// Names of the passes
+    static constexpr std::array<std::string_view, size> names()
+    { return namesImpl(std::make_index_sequence<size>{}); }
+
+    /// Create a new instance of a pass, nullptr if the index is out of range
+    static inline DrawingPass* create(size_t index)
+    { return createImpl(index, std::make_index_sequence<size>{}); }
+
+    /// Create a copy of a pass, with the same parameters. nullptr if the index is out of range
+    /// \warning pass must be an instance of PassType<index>
+    static inline DrawingPass* clone(size_t index, const DrawingPass* pass)
+    { return cloneImpl(index, pass, std::make_index_sequence<size>{}); }
+
+    /// Call f with the pass cast to its actual type
+    /// \return false if the index is out of range
+    template <typename Functor>
+    static inline bool visit(size_t index, DrawingPass* pass, Functor&& f)
+    { return visitImpl(index, pass, f, std::make_index_sequence<size>{}); }
+
+    /// Check if a pass type derives from Base
+    template <typename Base>
+    static constexpr bool derivesFrom(size_t index)
+    { return derivesFromImpl<Base>(index, std::make_index_sequence<size>{}); }
+
+    /// Check if a pass type satisfies a type trait, e.g. #IsFitField
+    template <template <typename> class Trait>
+    static constexpr bool satisfies(size_t index)
+    { return satisfiesImpl<Trait>(index, std::make_index_sequence<size>{}); }
+
+private:
+    template <size_t... I>
+    static constexpr std::array<std::string_view, size> namesImpl(std::index_sequence<I...>)
+    { return {std::get<I>(drawingPassRegistry).name...}; }
+
+    template <size_t... I>
+    static inline DrawingPass* createImpl(size_t index, std::index_sequence<I...>) {
+        DrawingPass* p = nullptr;
+        ((index == I ? (p = new PassType<I>(), true) : false) || ...);
+        return p;
+    }
+
+    template <size_t... I>
+    static inline DrawingPass* cloneImpl(size_t index, const DrawingPass* pass, std::index_sequence<I...>) {
+        DrawingPass* p = nullptr;
+        ((index == I ? (p = new PassType<I>(*static_cast<const PassType<I>*>(pass)), true) : false) || ...);
+        return p;
+    }
+
+    template <typename Functor, size_t... I>
+    static inline bool visitImpl(size_t index, DrawingPass* pass, Functor& f, std::index_sequence<I...>)
+    { return ((index == I ? (f(static_cast<PassType<I>*>(pass)), true) : false) || ...); }
+
+    template <typename Base, size_t... I>
+    static constexpr bool derivesFromImpl(size_t index, std::index_sequence<I...>)
+    { return ((index == I && std::is_base_of_v<Base, PassType<I>>) || ...); }
+
+    template <template <typename> class Trait, size_t... I>
+    static constexpr bool satisfiesImpl(size_t index, std::index_sequence<I...>)
+    { return ((index == I && Trait<PassType<I>>::value) || ...); }
+};
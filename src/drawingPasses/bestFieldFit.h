@@ -65,15 +65,14 @@ private:
 
 
 // Fit a unique primitive to the entire point cloud
-template <typename _FitType>
+template <typename _FitType, typename _PostProcess = NoPostProcess>
 struct BestFitField : public SingleFitField<_FitType, DrawingPass> {
     inline explicit BestFitField() : SingleFitField<_FitType, DrawingPass> () {}
     ~BestFitField() override = default;
 
     using FitType = _FitType;
-
-    /// Method called at the end of the fitting process, only for stable fits
-    virtual void postProcess(FitType& /*fit*/){};
+    /// Policy called at the end of the fitting process
+    using PostProcess = _PostProcess;
 
     inline float configureAndFit(const KdTree& points, FitType& fit, RenderingContext ctx) override {
         // Configure computation to be centered on the point cloud coordinates
@@ -82,44 +81,37 @@ struct BestFitField : public SingleFitField<_FitType, DrawingPass> {
         fit.init();
         // Compute fit
         fit.compute(points.points());
-        postProcess(fit);
+        PostProcess::apply(fit);
         return scale;
     }
 };
 
-using BestPlaneFitField = BestFitField<ConstPlaneFit>;
-
-struct BestSphereFitField : public BestFitField<ConstSphereFit>{
-    void postProcess(typename BestFitField<ConstSphereFit>::FitType& fit) override { fit.applyPrattNorm(); };
-};
-
-struct BestOrientedSphereFitField : public BestFitField<ConstOrientedSphereFit>{
-    void postProcess(typename BestFitField<ConstOrientedSphereFit>::FitType& fit) override { fit.applyPrattNorm(); };
-};
+using BestPlaneFitField          = BestFitField<ConstPlaneFit>;
+using BestSphereFitField         = BestFitField<ConstSphereFit, PrattNormPostProcess>;
+using BestOrientedSphereFitField = BestFitField<ConstOrientedSphereFit, PrattNormPostProcess>;
 
 
 // Fit a primitive to single point of the point cloud
-template <typename _FitType>
+template <typename _FitType, typename _PostProcess = NoPostProcess>
 struct OnePointFitField : public SingleFitField<_FitType, BaseFitField>, public OnePointFitFieldBase {
     inline explicit OnePointFitField() : SingleFitField<_FitType, BaseFitField> (), OnePointFitFieldBase() {}
     ~OnePointFitField() override = default;
 
     using FitType     = _FitType;
     using Scalar     = typename FitType::Scalar;
-
-    /// Method called at the end of the fitting process, only for stable fits
-    virtual void postProcess(FitType& /*fit*/){};
+    /// Policy called at the end of the fitting process, only for stable fits
+    using PostProcess = _PostProcess;
 
     inline float configureAndFit(const KdTree& points, FitType& fit, RenderingContext ctx) override {
         // Configure computation to be centered on the point cloud coordinates
-        auto query = points.points()[pointId].pos();
+        DataPoint::VectorType query = points.points()[pointId].pos();
         // Compute fit
         for (int iter = 0; iter != BaseFitField::params.m_iter; ++iter) {
             fit.setWeightFunc({query, BaseFitField::params.m_scale});
             fit.init();
             if (fit.computeWithIds(points.range_neighbors(query, BaseFitField::params.m_scale), points.points()) ==
                 Ponca::STABLE) {
-                postProcess(fit);
+                PostProcess::apply(fit);
                 query = fit.project(query);
             }
             else{
@@ -130,12 +122,6 @@ struct OnePointFitField : public SingleFitField<_FitType, BaseFitField>, public
     }
 };
 
-using OnePlaneFitField = OnePointFitField<ConstPlaneFit>;
-
-struct OneSphereFitField : public OnePointFitField<ConstSphereFit>{
-    void postProcess(typename OnePointFitField<ConstSphereFit>::FitType& fit) override { fit.applyPrattNorm(); };
-};
-
-struct OneOrientedSphereFitField : public OnePointFitField<ConstOrientedSphereFit>{
-    void postProcess(typename OnePointFitField<ConstOrientedSphereFit>::FitType& fit) override { fit.applyPrattNorm(); };
-};
+using OnePlaneFitField          = OnePointFitField<ConstPlaneFit>;
+using OneSphereFitField         = OnePointFitField<ConstSphereFit, PrattNormPostProcess>;
+using OneOrientedSphereFitField = OnePointFitField<ConstOrientedSphereFit, PrattNormPostProcess>;
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "../drawingPass.h"
+#include "../poncaTypes.h"
+#include "../tileScheduler.h"
+#include "../uniformGrid.h"
+#include "poncaFitField.h"
+
+#include <array>
+#include <cmath> // abs
+#include <optional>
+#include <string_view>
+#include <tuple>
+#include <utility> // index_sequence
+#include <vector>
+
+/// Compare the MLS fits on the same neighborhoods
+///
+/// Each evaluation point gathers its neighbors once, and feeds them to all the fits: comparing the fits costs one
+/// range query per point instead of one per fit. With several MLS iterations, the following queries depend on the
+/// projection of each fit, and are not shared.
+///
+/// Layouts:
+///   - GRID: one quadrant per fit, each showing the whole view at half resolution. Quadrants are ordered by
+///     increasing x then y, as in #fitNames
+///   - DIFFERENCE: potential of the fit first minus the potential of the fit second, where both are stable
+struct CompareFitsField : public BaseFitField {
+    using Fields = std::tuple<PlaneFitField, SphereFitField, OrientedSphereFitField, UnorientedSphereFitField>;
+    static constexpr size_t nbFits = std::tuple_size_v<Fields>;
+    static constexpr std::array<std::string_view, nbFits> fitNames {"plane", "sphere", "oriented", "unoriented"};
+
+    enum Layout: int {
+        GRID,
+        DIFFERENCE
+    };
+    static constexpr std::array<std::string_view, 2> layoutNames {"grid", "difference"};
+
+    inline explicit CompareFitsField() : BaseFitField() {}
+    ~CompareFitsField() override = default;
+
+    Layout layout {GRID};
+    int first {0};  ///< index in #fitNames of the first fit of the difference
+    int second {2}; ///< index in #fitNames of the second fit of the difference
+
+    void render(const KdTree& points, float*buffer, RenderingContext ctx) override{
+        if(points.points().empty()) return;
+        if(ctx.grid != nullptr)
+            renderWith(points, *ctx.grid, buffer, ctx);
+        else
+            renderWith(points, points, buffer, ctx);
+    }
+
+private:
+    using VectorType = DataPoint::VectorType;
+    using Values = std::array<std::optional<float>, nbFits>; ///< field values, std::nullopt if the fit is not stable
+    /// View on the gathered neighbors, passed by value to the fits without copying them
+    struct IdRange {
+        const int *b, *e;
+        inline const int* begin() const { return b; }
+        inline const int* end()   const { return e; }
+    };
+
+    template <typename SpatialIndex>
+    void renderWith(const KdTree& tree, const SpatialIndex& points, float*buffer, RenderingContext ctx){
+        const auto write = [buffer, &ctx](int i, int j, const std::optional<float>& value) {
+            auto *b = buffer + (i + j * ctx.w) * 4;
+            if (value) {
+                b[0] = *value;
+                b[2] = ColorMap::VALUE_IS_VALID;
+                b[3] = ColorMap::SCALAR_FIELD;
+            } else
+                b[2] = ColorMap::VALUE_IS_INVALID;
+        };
+
+        if (layout == GRID) {
+            // pixels left over by odd image sizes
+            for (size_t k = 0; k < ctx.w * ctx.h; ++k) buffer[k * 4 + 2] = ColorMap::VALUE_IS_INVALID;
+            // the whole view at half resolution
+            RenderingContext view = ctx;
+            view.w = ctx.w / 2;
+            view.h = ctx.h / 2;
+            view.scale = ctx.scale * 2.f;
+            view.fields = nullptr;
+            const int qw = int(view.w), qh = int(view.h);
+            forEachPixel(tree, view, params.m_scale, [this, &points, &view, &write, qw, qh](int i, int j) {
+                const Values values = evaluate(points, view, i, j);
+                for (size_t f = 0; f != nbFits; ++f)
+                    write(i + int(f % 2) * qw, j + int(f / 2) * qh, values[f]);
+            }, [&write, qw, qh](int i, int j) {
+                for (size_t f = 0; f != nbFits; ++f)
+                    write(i + int(f % 2) * qw, j + int(f / 2) * qh, std::nullopt);
+            });
+        } else {
+            forEachPixel(tree, ctx, params.m_scale, [this, &points, &ctx, &write](int i, int j) {
+                const Values values = evaluate(points, ctx, i, j);
+                const auto& a = values[size_t(first)];
+                const auto& b = values[size_t(second)];
+                write(i, j, a && b ? std::optional<float>(*a - *b) : std::nullopt);
+            }, [&write](int i, int j) { write(i, j, std::nullopt); });
+        }
+        // store data for colormap processing (see #ColorMap)
+        buffer[1] = params.m_scale;
+        buffer[3] = ColorMap::SCALAR_FIELD;
+    }
+
+    /// Evaluate all the fits at a pixel, from a single gathering of the neighbors
+    template <typename SpatialIndex>
+    inline Values evaluate(const SpatialIndex& points, const RenderingContext& ctx, int i, int j) const {
+        thread_local std::vector<int> ids; // reused between the pixels processed by the same thread
+        const auto coord = ctx.pixToPoint(i, j);
+        const VectorType x (coord.first, coord.second);
+        ids.clear();
+        for (int id : points.range_neighbors(x, params.m_scale)) ids.push_back(id);
+
+        Values values;
+        evaluateAll(points, x, ids, values, std::make_index_sequence<nbFits>{});
+        return values;
+    }
+
+    template <typename SpatialIndex, size_t... I>
+    inline void evaluateAll(const SpatialIndex& points, const VectorType& x, const std::vector<int>& ids,
+                            Values& values, std::index_sequence<I...>) const {
+        ((values[I] = evaluateFit<std::tuple_element_t<I, Fields>>(points, x, ids)), ...);
+    }
+
+    /// Same as #FitField, with the neighbors of the first iteration given
+    template <typename Field, typename SpatialIndex>
+    inline std::optional<float> evaluateFit(const SpatialIndex& points, const VectorType& x,
+                                            const std::vector<int>& ids) const {
+        typename Field::FitType fit;
+        VectorType query = x;
+        fit.setWeightFunc({query, params.m_scale});
+        for (int iter = 0; iter != params.m_iter; ++iter) {
+            fit.init();
+            const auto res = iter == 0 ? fit.computeWithIds(IdRange{ids.data(), ids.data() + ids.size()},
+                                                            points.points())
+                                       : fit.computeWithIds(points.range_neighbors(query, params.m_scale),
+                                                            points.points());
+            if (res == Ponca::STABLE) query = fit.project(query);
+        }
+        if (! fit.isStable()) return std::nullopt;
+        Field::PostProcess::apply(fit);
+        const float dist = fit.potential(x);
+        return fit.isSigned() ? dist : std::abs(dist);
+    }
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "../drawingPass.h"
+#include "../poncaTypes.h"
+#include "../tileScheduler.h"
+#include "poncaFitField.h"
+
+#include <algorithm> // max
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <string_view>
+
+/// Parameters of the #CostField passes, independent of the fit type
+struct CostFieldBase {
+    /// Cost displayed for each pixel
+    enum Metric: int {
+        NEIGHBORS,  ///< neighbors added to the fit, summed over the passes and MLS iterations
+        NODES,      ///< kd-tree nodes visited by the range queries (see #countNodesInBall)
+        ITERATIONS, ///< passes over the neighborhood, summed over the MLS iterations
+        TIME        ///< wall-clock time, in nanoseconds
+    };
+    static constexpr std::array<std::string_view, 4> metricNames {"neighbors", "nodes", "iterations", "time"};
+
+    Metric metric {NEIGHBORS};
+    double lastTotal {0}; ///< sum of the costs of the last rendered image
+};
+
+/// Profiling pass: render the cost of the fit of each pixel instead of the field
+///
+/// Fits are computed as in #FitField, with the same scheduling and coverage culling, so costly regions of the image
+/// are the ones that slow the actual render down. The cost is written as a positive scalar field, to be displayed by
+/// #ColorMap: the brighter, the more expensive. Pixels without any work are left undefined.
+template <typename _FitType, typename _PostProcess = NoPostProcess>
+struct CostField : public BaseFitField, public CostFieldBase {
+    inline explicit CostField() : BaseFitField() {}
+    ~CostField() override = default;
+
+    using FitType = _FitType;
+    using PostProcess = _PostProcess;
+
+    void render(const KdTree& points, float*buffer, RenderingContext ctx) override{
+        if(points.points().empty()) return;
+        if(ctx.grid != nullptr)
+            renderCostWith(points, *ctx.grid, buffer, ctx);
+        else
+            renderCostWith(points, points, buffer, ctx);
+    }
+
+private:
+    template <typename SpatialIndex>
+    void renderCostWith(const KdTree& tree, const SpatialIndex& points, float*buffer, RenderingContext ctx){
+        forEachPixel(tree, ctx, params.m_scale, [this, &tree, &points, buffer, &ctx](int i, int j) {
+            const auto start = std::chrono::steady_clock::now();
+            auto coord = ctx.pixToPoint(i,j);
+            DataPoint::VectorType query (coord.first, coord.second);
+            size_t neighbors = 0, passes = 0, nodes = 0;
+
+            // same as FitField, with the multipass loop of computeWithIds unrolled to count its work
+            FitType fit;
+            fit.setWeightFunc({query, params.m_scale});
+            for (int iter = 0; iter != params.m_iter; ++iter) {
+                fit.init();
+                if (metric == NODES) nodes += countNodesInBall(tree, query, params.m_scale);
+                const auto ids = points.range_neighbors(query, params.m_scale);
+                Ponca::FIT_RESULT res;
+                do {
+                    fit.startNewPass();
+                    for (const auto& id : ids) {
+                        fit.addNeighbor(points.points()[id]);
+                        ++neighbors;
+                    }
+                    res = fit.finalize();
+                    ++passes;
+                } while (res == Ponca::NEED_OTHER_PASS);
+                if (res == Ponca::STABLE) query = fit.project(query);
+            }
+            if (fit.isStable()) PostProcess::apply(fit);
+
+            float cost = 0;
+            switch (metric) {
+                case NEIGHBORS:  cost = float(neighbors); break;
+                case NODES:      cost = float(nodes); break;
+                case ITERATIONS: cost = float(passes); break;
+                case TIME:
+                    cost = float(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start)
+                                         .count());
+                    break;
+            }
+            auto *b = buffer + (i + j * ctx.w) * 4;
+            b[0] = cost;
+            b[2] = cost > 0.f ? ColorMap::VALUE_IS_VALID : ColorMap::VALUE_IS_INVALID;
+            b[3] = ColorMap::SCALAR_FIELD;
+        }, [buffer, &ctx](int i, int j) {
+            // culled without any fit
+            auto *b = buffer + (i + j * ctx.w) * 4;
+            b[0] = 0.f;
+            b[2] = ColorMap::VALUE_IS_INVALID;
+        });
+
+        float maxCost = 0.f;
+        lastTotal = 0;
+        for (size_t j = 0; j < ctx.w * ctx.h; ++j) {
+            maxCost = std::max(maxCost, buffer[j * 4]);
+            lastTotal += buffer[j * 4];
+        }
+        // store data for colormap processing (see #ColorMap): the max value is included
+        buffer[1] = std::nextafter(std::max(maxCost, 1.f), std::numeric_limits<float>::max());
+        buffer[3] = ColorMap::SCALAR_FIELD;
+    }
+};
+
+using PlaneCostField            = CostField<PlaneFit>;
+using SphereCostField           = CostField<SphereFit, PrattNormPostProcess>;
+using OrientedSphereCostField   = CostField<OrientedSphereFit, PrattNormPostProcess>;
+using UnorientedSphereCostField = CostField<UnorientedSphereFit, PrattNormPostProcess>;
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../drawingPass.h"
+#include "../momentFit.h"
+#include "../tileScheduler.h"
+
+
+/// MLS with constant weights, computed from the moments stored in the kd-tree nodes
+///
+/// Gives the same field as a #FitField using a `Const*Fit`, but the kd-tree nodes fully covered by the neighborhood
+/// are aggregated in O(1): the cost of a fit depends on the boundary of the neighborhood instead of its size.
+template <typename _FitType, typename _PostProcess = NoPostProcess>
+struct MomentFitField : public BaseFitField {
+    inline explicit MomentFitField() : BaseFitField() {}
+    ~MomentFitField() override = default;
+
+    using FitType = _FitType;
+    /// Policy called at the end of the fitting process, only for stable fits
+    using PostProcess = _PostProcess;
+
+    void render(const KdTree& points, float*buffer, RenderingContext ctx) override{
+        if(points.points().empty()) return;
+
+        /// Compute scalar field
+        auto *fields = ctx.fields;
+        forEachPixel(points, ctx, params.m_scale, [this, &points, buffer, &ctx, fields](int i, int j) {
+            auto *b = buffer + (i + j * ctx.w) * 4;
+            auto coord = ctx.pixToPoint(i,j);
+            DataPoint::VectorType query (coord.first, coord.second);
+
+            FitType fit;
+            for (int iter = 0; iter != params.m_iter; ++iter) {
+                fit.init(query);
+                if (fit.computeWithMoments(aggregateMoments(points, query, params.m_scale)) == Ponca::STABLE)
+                    query = fit.project(query);
+            }
+
+            if ( fit.isStable() ){
+                PostProcess::apply(fit);
+                float dist = fit.potential({coord.first,coord.second});
+
+                b[0] = fit.isSigned() ? dist : std::abs(dist);  // set pixel value
+                b[2] = ColorMap::VALUE_IS_VALID;
+                b[3] = ColorMap::SCALAR_FIELD;                         // set field type
+            }
+            else{
+                b[2] = ColorMap::VALUE_IS_INVALID;
+            }
+            if (fields) fields->write(i + j * ctx.w, fit, DataPoint::VectorType(coord.first, coord.second));
+        }, [buffer, &ctx, fields](int i, int j) {
+            // no point closer than the scale: the fit is not defined
+            buffer[(i + j * ctx.w) * 4 + 2] = ColorMap::VALUE_IS_INVALID;
+            if (fields) fields->writeUncovered(i + j * ctx.w, float(Ponca::UNDEFINED));
+        });
+        if (fields) fields->setWritten();
+        // store data for colormap processing (see #ColorMap)
+        buffer[1] = params.m_scale;
+        buffer[3] = ColorMap::SCALAR_FIELD;
+    }
+};
+
+using ConstPlaneMomentFitField          = MomentFitField<MomentPlaneFit>;
+using ConstSphereMomentFitField         = MomentFitField<MomentSphereFit, PrattNormPostProcess>;
+using ConstOrientedSphereMomentFitField = MomentFitField<MomentOrientedSphereFit, PrattNormPostProcess>;
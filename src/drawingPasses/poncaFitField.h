@@ -2,17 +2,20 @@
 
 #include "../drawingPass.h"
 #include "../poncaTypes.h"
+#include "../tileScheduler.h"
+#include "../uniformGrid.h"
 
+#include <type_traits>
 
-template <typename _FitType>
+
+template <typename _FitType, typename _PostProcess = NoPostProcess>
 struct FitField : public BaseFitField {
     inline explicit FitField() : BaseFitField() {}
     ~FitField() override = default;
 
     using FitType = _FitType;
-
-    /// Method called at the end of the fitting process, only for stable fits
-    virtual void postProcess(FitType& /*fit*/){};
+    /// Policy called at the end of the fitting process, only for stable fits
+    using PostProcess = _PostProcess;
 
     void render(const KdTree& points, float*buffer, RenderingContext ctx) override{
         if(points.points().empty()) return;
@@ -23,43 +26,55 @@ struct FitField : public BaseFitField {
 
 private:
     void renderScalarField(const KdTree& points, float*buffer, RenderingContext ctx){
+        if(ctx.grid != nullptr)
+            renderScalarFieldWith(points, *ctx.grid, buffer, ctx);
+        else
+            renderScalarFieldWith(points, points, buffer, ctx);
+    }
 
-        /// Compute scalar field
-        const int h = ctx.h;
-        const int w = ctx.w;
-#pragma omp parallel for collapse(2) default(none) shared(points, buffer, ctx, w, h)
-        for (int j = 0; j < h; ++j ) {
-            for (int i = 0; i < w; ++i) {
-                auto *b = buffer + (i + j * ctx.w) * 4;
-                auto coord = ctx.pixToPoint(i,j);
-                DataPoint::VectorType query (coord.first, coord.second);
+    /// Compute the scalar field using a spatial index providing points() and range_neighbors()
+    /// \param tree used to estimate the cost of the image tiles, see #forEachPixel
+    template <typename SpatialIndex>
+    void renderScalarFieldWith(const KdTree& tree, const SpatialIndex& points, float*buffer, RenderingContext ctx){
 
-                FitType fit;
-                // Set a weighting function instance
-                fit.setWeightFunc({query, params.m_scale});
-                // Set the evaluation position
-                for (int iter = 0; iter != params.m_iter; ++iter) {
-                    fit.init();
-                    // Fit plane (method compute handles multipass fitting
-                    if (fit.computeWithIds(points.range_neighbors(query, params.m_scale), points.points()) ==
-                        Ponca::STABLE) {
-                        query = fit.project(query);
-                    }
+        /// Compute scalar field
+        auto *fields = ctx.fields;
+        forEachPixel(tree, ctx, params.m_scale, [this, &points, buffer, &ctx, fields](int i, int j) {
+            auto *b = buffer + (i + j * ctx.w) * 4;
+            auto coord = ctx.pixToPoint(i,j);
+            DataPoint::VectorType query (coord.first, coord.second);
+
+            FitType fit;
+            // Set a weighting function instance
+            fit.setWeightFunc({query, params.m_scale});
+            // Set the evaluation position
+            for (int iter = 0; iter != params.m_iter; ++iter) {
+                fit.init();
+                // Fit plane (method compute handles multipass fitting
+                if (fit.computeWithIds(points.range_neighbors(query, params.m_scale), points.points()) ==
+                    Ponca::STABLE) {
+                    query = fit.project(query);
                 }
+            }
 
-                if ( fit.isStable() ){
-                    postProcess(fit);
-                    float dist = fit.potential({coord.first,coord.second});
+            if ( fit.isStable() ){
+                PostProcess::apply(fit);
+                float dist = fit.potential({coord.first,coord.second});
 
-                    b[0] = fit.isSigned() ? dist : std::abs(dist);  // set pixel value
-                    b[2] = ColorMap::VALUE_IS_VALID;
-                    b[3] = ColorMap::SCALAR_FIELD;                         // set field type
-                }
-                else{
-                    b[2] = ColorMap::VALUE_IS_INVALID;
-                }
+                b[0] = fit.isSigned() ? dist : std::abs(dist);  // set pixel value
+                b[2] = ColorMap::VALUE_IS_VALID;
+                b[3] = ColorMap::SCALAR_FIELD;                         // set field type
             }
-        }
+            else{
+                b[2] = ColorMap::VALUE_IS_INVALID;
+            }
+            if (fields) fields->write(i + j * ctx.w, fit, DataPoint::VectorType(coord.first, coord.second));
+        }, [buffer, &ctx, fields](int i, int j) {
+            // no point closer than the scale: the fit is not defined
+            buffer[(i + j * ctx.w) * 4 + 2] = ColorMap::VALUE_IS_INVALID;
+            if (fields) fields->writeUncovered(i + j * ctx.w, float(Ponca::UNDEFINED));
+        });
+        if (fields) fields->setWritten();
         // store data for colormap processing (see #ColorMap)
         buffer[1] = params.m_scale;
         buffer[3] = ColorMap::SCALAR_FIELD;
@@ -91,7 +106,7 @@ private:
                     fit.init();
                     if (fit.computeWithIds(points.range_neighbors(x, params.m_scale), points.points()) ==
                         Ponca::STABLE) {
-                        postProcess(fit);
+                        PostProcess::apply(fit);
                         nextx = fit.project(x);
                         potential = fit.potential(nextx);
 
@@ -118,14 +133,25 @@ private:
 
 };
 
-using PlaneFitField = FitField<PlaneFit>;
-
-struct SphereFitField : public FitField<SphereFit>{
-    void postProcess(typename FitField<SphereFit>::FitType& fit) override { fit.applyPrattNorm(); };
-};
-struct OrientedSphereFitField : public FitField<OrientedSphereFit>{
-    void postProcess(typename FitField<OrientedSphereFit>::FitType& fit) override { fit.applyPrattNorm(); };
-};
-struct UnorientedSphereFitField : public FitField<UnorientedSphereFit>{
-    void postProcess(typename FitField<UnorientedSphereFit>::FitType& fit) override { fit.applyPrattNorm(); };
-};
+/// Check if a pass type is a #FitField, to reuse its fit type and post-processing outside the pass
+template <typename T>
+struct IsFitField : std::false_type {};
+template <typename _FitType, typename _PostProcess>
+struct IsFitField<FitField<_FitType, _PostProcess>> : std::true_type {};
+
+/// Check if a fit type produces a signed field, as reported by its `isSigned()` method
+template <typename FitType>
+struct IsSignedFit : std::true_type {};
+template <>
+struct IsSignedFit<UnorientedSphereFit> : std::false_type {};
+
+/// Check if a pass type is a #FitField producing a signed field, i.e. with a zero-isocontour (see contourTracing.h)
+template <typename T>
+struct IsSignedFitField : std::false_type {};
+template <typename _FitType, typename _PostProcess>
+struct IsSignedFitField<FitField<_FitType, _PostProcess>> : IsSignedFit<_FitType> {};
+
+using PlaneFitField            = FitField<PlaneFit>;
+using SphereFitField           = FitField<SphereFit, PrattNormPostProcess>;
+using OrientedSphereFitField   = FitField<OrientedSphereFit, PrattNormPostProcess>;
+using UnorientedSphereFitField = FitField<UnorientedSphereFit, PrattNormPostProcess>;
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm> // fill_n
+#include <array>
+#include <cmath>
+#include <limits>
+#include <string_view>
+#include <type_traits>
+#include <utility> //declval
+#include <vector>
+
+namespace internal {
+    template <typename T, typename = void>
+    struct HasRadius : std::false_type {};
+    template <typename T>
+    struct HasRadius<T, std::void_t<decltype(std::declval<const T&>().radius())>> : std::true_type {};
+}
+
+/// Signed curvature of a stable fit: positive for spheres whose gradient points outward, 0 for planes and fits
+/// without radius
+template <typename FitType>
+inline float signedCurvature(const FitType& fit) {
+    if constexpr (internal::HasRadius<FitType>::value) {
+        if (fit.isPlane()) return 0.f;
+        using VectorType = typename FitType::VectorType;
+        const VectorType e = VectorType::UnitX();
+        const float sign = fit.primitiveGradient(fit.center() + e).dot(e) > 0 ? 1.f : -1.f;
+        return sign / float(fit.radius());
+    } else
+        return 0.f;
+}
+
+/// Multi-channel output of the fit passes: one float plane per channel, filled from a single fit per pixel
+///
+/// Channels are optional: only the enabled planes are allocated and written. Values are NaN where the fit is not
+/// defined (e.g. unstable fits), except for the number of neighbors and the fit state. Planes are either owned by the
+/// buffer (see #resize) or provided by the caller (see #wrap).
+struct FieldBuffer {
+    enum Channel: int {
+        POTENTIAL,      ///< potential at the pixel, as rendered by the pass
+        GRADIENT_X,     ///< primitive gradient at the pixel
+        GRADIENT_Y,
+        GRADIENT_NORM,
+        CURVATURE,      ///< signed curvature of the fitted sphere, 0 for planes
+        NEIGHBOR_COUNT, ///< number of neighbors used by the last fit iteration
+        FIT_STATE,      ///< Ponca::FIT_RESULT of the last fit iteration
+        NB_CHANNELS
+    };
+    static constexpr unsigned int ALL_CHANNELS = (1u << NB_CHANNELS) - 1;
+
+    static constexpr std::array<std::string_view, NB_CHANNELS> channelNames {
+        "potential", "gradient_x", "gradient_y", "gradient_norm", "curvature", "neighbors", "state"
+    };
+
+    FieldBuffer() = default;
+    // planes point into m_data: copies would share it
+    FieldBuffer(const FieldBuffer&) = delete;
+    FieldBuffer& operator=(const FieldBuffer&) = delete;
+    FieldBuffer(FieldBuffer&&) = default;
+    FieldBuffer& operator=(FieldBuffer&&) = default;
+
+    /// Index of a channel from its name, -1 if unknown
+    static inline int channelIndex(std::string_view name) {
+        for (int c = 0; c != NB_CHANNELS; ++c)
+            if (channelNames[c] == name) return c;
+        return -1;
+    }
+
+    /// Allocate the enabled channels and mark the buffer as not written
+    inline void resize(size_t w, size_t h, unsigned int channels = ALL_CHANNELS) {
+        m_w = w;
+        m_h = h;
+        m_channels = channels & ALL_CHANNELS;
+        size_t nbPlanes = 0;
+        for (int c = 0; c != NB_CHANNELS; ++c)
+            if (has(Channel(c))) ++nbPlanes;
+        m_data.assign(nbPlanes * w * h, std::numeric_limits<float>::quiet_NaN());
+        nbPlanes = 0;
+        for (int c = 0; c != NB_CHANNELS; ++c)
+            m_planes[c] = has(Channel(c)) ? m_data.data() + (nbPlanes++) * w * h : nullptr;
+        m_written = false;
+    }
+
+    /// Write the channels to caller-owned planes of w*h floats, nullptr for the disabled channels, and mark the buffer
+    /// as not written. Planes are filled with NaN, and must outlive the buffer or the next call to #resize or #wrap
+    inline void wrap(size_t w, size_t h, const std::array<float*, NB_CHANNELS>& planes) {
+        m_w = w;
+        m_h = h;
+        m_channels = 0;
+        m_data.clear();
+        m_planes = planes;
+        for (int c = 0; c != NB_CHANNELS; ++c) {
+            if (planes[c] == nullptr) continue;
+            m_channels |= 1u << c;
+            std::fill_n(planes[c], w * h, std::numeric_limits<float>::quiet_NaN());
+        }
+        m_written = false;
+    }
+
+    [[nodiscard]] inline size_t width()  const { return m_w; }
+    [[nodiscard]] inline size_t height() const { return m_h; }
+    [[nodiscard]] inline bool has(Channel c) const { return (m_channels & (1u << c)) != 0; }
+
+    /// Plane of a channel, nullptr if the channel is not enabled
+    [[nodiscard]] inline float* plane(Channel c) { return m_planes[c]; }
+    [[nodiscard]] inline const float* plane(Channel c) const { return m_planes[c]; }
+
+    /// True if a pass filled the buffer since the last #resize
+    [[nodiscard]] inline bool isWritten() const { return m_written; }
+    inline void setWritten() { m_written = true; }
+
+    /// Write the channels of a pixel from a fit evaluated at x. Thread-safe for different pixels
+    template <typename FitType, typename VectorType>
+    inline void write(size_t pixel, const FitType& fit, const VectorType& x) {
+        constexpr float nan = std::numeric_limits<float>::quiet_NaN();
+        const bool stable = fit.isStable();
+        set(NEIGHBOR_COUNT, pixel, float(fit.getNumNeighbors()));
+        set(FIT_STATE, pixel, float(fit.getCurrentState()));
+        if (stable) {
+            const auto pot = float(fit.potential(x));
+            set(POTENTIAL, pixel, fit.isSigned() ? pot : std::abs(pot));
+        } else
+            set(POTENTIAL, pixel, nan);
+        set(CURVATURE, pixel, stable ? signedCurvature(fit) : nan);
+        if (has(GRADIENT_X) || has(GRADIENT_Y) || has(GRADIENT_NORM)) {
+            const VectorType g = stable ? VectorType(fit.primitiveGradient(x)) : VectorType::Constant(nan);
+            set(GRADIENT_X, pixel, g.x());
+            set(GRADIENT_Y, pixel, g.y());
+            set(GRADIENT_NORM, pixel, g.norm());
+        }
+    }
+
+    /// Write the channels of a pixel without neighbors, where no fit has been computed
+    /// \param state Ponca::FIT_RESULT reported for the pixel
+    inline void writeUncovered(size_t pixel, float state) {
+        constexpr float nan = std::numeric_limits<float>::quiet_NaN();
+        for (int c = 0; c != NB_CHANNELS; ++c) set(Channel(c), pixel, nan);
+        set(NEIGHBOR_COUNT, pixel, 0.f);
+        set(FIT_STATE, pixel, state);
+    }
+
+private:
+    inline void set(Channel c, size_t pixel, float value) {
+        if (m_planes[c] != nullptr) m_planes[c][pixel] = value;
+    }
+
+    size_t m_w {0}, m_h {0};
+    unsigned int m_channels {0};
+    std::array<float*, NB_CHANNELS> m_planes {};  ///< nullptr for the disabled channels
+    std::vector<float> m_data;                    ///< owned planes, empty if wrapped
+    bool m_written {false};
+};
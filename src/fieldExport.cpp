@@ -0,0 +1,61 @@
+#include "fieldExport.h"
+#include "fieldBuffer.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string_view>
+#include <utility> //pair
+#include <vector>
+
+namespace poncaplot {
+    bool write_field(int w, int h, const float *texture, const FieldBuffer *fields, const std::string &path,
+                     unsigned int channels) {
+        // name and data of the planes stored in fields
+        std::vector<std::pair<std::string_view, const float *>> planes;
+        if (fields != nullptr)
+            for (int c = 0; c != FieldBuffer::NB_CHANNELS; ++c)
+                if (fields->has(FieldBuffer::Channel(c)) && (channels & (1u << c)) != 0)
+                    planes.emplace_back(FieldBuffer::channelNames[c], fields->plane(FieldBuffer::Channel(c)));
+        const size_t nbPlanes = 2 + planes.size();
+
+        const bool npy = path.size() >= 4 && path.compare(path.size() - 4, 4, ".npy") == 0;
+        std::ofstream out(path, std::ios::out | std::ios::binary);
+        if (!out.is_open()) return false;
+
+        const std::string shape = "(" + std::to_string(nbPlanes) + ", " + std::to_string(h) + ", " +
+                                  std::to_string(w) + ")";
+        if (npy) {
+            // NPY format 1.0: magic, version, header length, then the header padded with spaces so that the data
+            // starts on a multiple of 64 bytes
+            std::string header = "{'descr': '<f4', 'fortran_order': False, 'shape': " + shape + ", }";
+            const size_t unpadded = 10 + header.size() + 1;
+            header.append((64 - unpadded % 64) % 64, ' ');
+            header.push_back('\n');
+            const auto len = uint16_t(header.size());
+            out.write("\x93NUMPY\x01\x00", 8);
+            const char lenBytes[2] {char(len & 0xff), char(len >> 8)};
+            out.write(lenBytes, 2);
+            out.write(header.data(), std::streamsize(header.size()));
+        } else {
+            std::ofstream json(path + ".json");
+            if (!json.is_open()) return false;
+            json << "{\n  \"dtype\": \"float32\",\n  \"byte_order\": \"little\",\n"
+                 << "  \"shape\": [" << nbPlanes << ", " << h << ", " << w << "],\n"
+                 << "  \"planes\": [\"value\", \"validity\"";
+            for (const auto &p: planes) json << ", \"" << p.first << "\"";
+            json << "]\n}\n";
+        }
+
+        // value and validity are interleaved in the texture: gather them one row at a time
+        std::vector<float> row (w);
+        for (int slot: {0, 2})
+            for (int j = 0; j < h; ++j) {
+                const float *src = texture + size_t(j) * w * 4 + slot;
+                for (int i = 0; i < w; ++i) row[i] = src[size_t(i) * 4];
+                out.write(reinterpret_cast<const char *>(row.data()), std::streamsize(row.size() * sizeof(float)));
+            }
+        for (const auto &p: planes)
+            out.write(reinterpret_cast<const char *>(p.second), std::streamsize(size_t(w) * h * sizeof(float)));
+        return bool(out);
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+// forward declarations
+struct FieldBuffer;
+
+namespace poncaplot {
+    /// Save the raw output of a fit pass, before colormapping, as float32 planes
+    ///
+    /// Planes are: the pass value (texture channel 0), the validity flag (texture channel 2: 1 valid, 0 invalid,
+    /// -1 trajectory) and, if fields is not null, the channels of fields enabled in both fields and the channels mask,
+    /// in #FieldBuffer::Channel order.
+    /// Format depends on the extension of path:
+    ///   - .npy: NumPy array of shape (planes, h, w), little-endian float32
+    ///   - otherwise (e.g. .raw): the same bytes without header, described by a JSON sidecar (path + ".json")
+    ///
+    /// Data is streamed row by row: no copy of the field is made.
+    /// \return false if a file cannot be written
+    bool write_field(int w, int h, const float *texture, const FieldBuffer *fields, const std::string &path,
+                     unsigned int channels = ~0u);
+}
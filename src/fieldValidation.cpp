@@ -0,0 +1,109 @@
+#include "fieldValidation.h"
+#include "drawingPass.h" // ColorMap
+
+#include <algorithm> // max, min
+#include <cmath>
+#include <vector>
+
+namespace poncaplot {
+    namespace {
+        /// Mask of the isocontour pixels of a field, see #compareFields
+        std::vector<char> isoPixels(size_t w, size_t h, const float *texture) {
+            const auto valid = [texture](size_t k) { return texture[k * 4 + 2] == ColorMap::VALUE_IS_VALID; };
+            const auto crosses = [texture, &valid](size_t a, size_t b) {
+                return valid(b) && (texture[a * 4] < 0.f) != (texture[b * 4] < 0.f);
+            };
+            std::vector<char> mask(w * h, 0);
+            for (size_t j = 0; j != h; ++j)
+                for (size_t i = 0; i != w; ++i) {
+                    const size_t k = i + j * w;
+                    if (valid(k) && ((i + 1 < w && crosses(k, k + 1)) || (j + 1 < h && crosses(k, k + w))))
+                        mask[k] = 1;
+                }
+            return mask;
+        }
+
+        /// Distance from each pixel of from to the nearest pixel of to, accumulated in sum and max
+        void isoShifts(size_t w, size_t h, const std::vector<char> &from, const std::vector<char> &to,
+                       int maxShift, double &sum, float &max, size_t &count) {
+            const int iw = int(w), ih = int(h);
+            double localSum = 0;
+            float localMax = 0;
+            size_t localCount = 0;
+#pragma omp parallel for default(none) shared(from, to, maxShift, iw, ih) \
+        reduction(+:localSum, localCount) reduction(max:localMax) schedule(dynamic, 16)
+            for (int j = 0; j < ih; ++j) {
+                for (int i = 0; i < iw; ++i) {
+                    if (!from[i + j * iw]) continue;
+                    int best2 = (maxShift + 1) * (maxShift + 1);
+                    // square rings of growing radius, until no closer pixel can be found
+                    for (int r = 0; r <= maxShift && r * r < best2; ++r) {
+                        for (int dj = -r; dj <= r; ++dj) {
+                            const int y = j + dj;
+                            if (y < 0 || y >= ih) continue;
+                            const int step = (dj == -r || dj == r) ? 1 : 2 * r;
+                            for (int di = -r; di <= r; di += step) {
+                                const int x = i + di;
+                                if (x >= 0 && x < iw && to[x + y * iw]) best2 = std::min(best2, di * di + dj * dj);
+                            }
+                        }
+                    }
+                    const float d = std::sqrt(float(best2));
+                    localSum += d;
+                    localMax = std::max(localMax, d);
+                    ++localCount;
+                }
+            }
+            sum += localSum;
+            max = std::max(max, localMax);
+            count += localCount;
+        }
+    }
+
+    FieldComparison compareFields(size_t w, size_t h, const float *reference, const float *candidate,
+                                  int maxIsoShift) {
+        FieldComparison c;
+        double sum2 = 0;
+        for (size_t k = 0; k != w * h; ++k) {
+            const bool validRef = reference[k * 4 + 2] == ColorMap::VALUE_IS_VALID;
+            const bool validCand = candidate[k * 4 + 2] == ColorMap::VALUE_IS_VALID;
+            if (validRef != validCand) {
+                ++c.validityMismatches;
+                continue;
+            }
+            if (!validRef) continue;
+            const float e = std::abs(reference[k * 4] - candidate[k * 4]);
+            c.maxError = std::max(c.maxError, e);
+            sum2 += double(e) * double(e);
+            ++c.compared;
+        }
+        if (c.compared != 0) c.rmsError = float(std::sqrt(sum2 / double(c.compared)));
+
+        // symmetric: contours missing from either field count
+        const auto isoRef = isoPixels(w, h, reference);
+        const auto isoCand = isoPixels(w, h, candidate);
+        double sum = 0;
+        isoShifts(w, h, isoRef, isoCand, maxIsoShift, sum, c.isoShiftMax, c.isoPixels);
+        isoShifts(w, h, isoCand, isoRef, maxIsoShift, sum, c.isoShiftMax, c.isoPixels);
+        if (c.isoPixels != 0) c.isoShiftMean = float(sum / double(c.isoPixels));
+        return c;
+    }
+
+    bool checkFields(const FieldComparison &c, const ValidationThresholds &t, float scale, size_t nbPixels,
+                     std::ostream &report) {
+        bool ok = true;
+        const auto line = [&report, &ok](const char *name, double value, double threshold) {
+            const bool pass = value <= threshold;
+            report << "  " << name << ": " << value << " (max " << threshold << ")" << (pass ? "" : "  FAILED")
+                   << "\n";
+            ok &= pass;
+        };
+        report << "  compared pixels: " << c.compared << "\n";
+        line("max error", c.maxError, t.maxError * scale);
+        line("rms error", c.rmsError, t.rmsError * scale);
+        line("validity mismatches", double(c.validityMismatches), t.mismatchRatio * double(nbPixels));
+        line("isocontour shift (max, px)", c.isoShiftMax, t.isoShift);
+        report << "  isocontour shift (mean, px): " << c.isoShiftMean << " over " << c.isoPixels << " pixels\n";
+        return ok;
+    }
+}
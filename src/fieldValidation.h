@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+
+namespace poncaplot {
+    /// Differences between the raw outputs of a fit pass (see #write_field) rendered in two modes
+    struct FieldComparison {
+        size_t compared {0};           ///< pixels valid in both fields
+        size_t validityMismatches {0}; ///< pixels valid in one field only
+        float maxError {0};            ///< maximum absolute difference of the values, in point units
+        float rmsError {0};            ///< root mean square difference of the values, in point units
+        size_t isoPixels {0};          ///< pixels of the zero-isocontours, in both fields
+        float isoShiftMax {0};         ///< maximum distance between the isocontours of the two fields, in pixels
+        float isoShiftMean {0};        ///< mean distance between the isocontours of the two fields, in pixels
+    };
+
+    /// Compare a candidate field to a reference field, both w*h*4 texture buffers before colormapping
+    ///
+    /// Isocontour pixels are the valid pixels whose right or bottom neighbor has a value of opposite sign. The shift
+    /// of a pixel is the distance to the nearest isocontour pixel of the other field, searched up to maxIsoShift
+    /// pixels away: pixels without match count as maxIsoShift + 1.
+    FieldComparison compareFields(size_t w, size_t h, const float *reference, const float *candidate,
+                                  int maxIsoShift = 16);
+
+    /// Acceptance thresholds of a #FieldComparison
+    struct ValidationThresholds {
+        float maxError {0.05f};     ///< relative to the fitting scale
+        float rmsError {0.01f};     ///< relative to the fitting scale
+        float isoShift {2.f};       ///< in pixels
+        float mismatchRatio {0.01f}; ///< ratio of the image pixels
+    };
+
+    /// Print the comparison and check it against the thresholds
+    /// \return true if all the thresholds are met
+    bool checkFields(const FieldComparison &c, const ValidationThresholds &t, float scale, size_t nbPixels,
+                     std::ostream &report);
+}
@@ -58,5 +58,5 @@ int main(int argc , char ** argv) {
     }
 
     clean();
-    return 0;
+    return cli.exitCode();
 }
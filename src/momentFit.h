@@ -0,0 +1,231 @@
+#pragma once
+
+#include "poncaTypes.h"
+
+#include <Eigen/Eigenvalues>
+
+#include <algorithm> // max
+#include <array>
+#include <cmath>
+#include <limits>
+
+using KdTreeMoments = typename KdTree::NodeType::MomentsType;
+
+/// Sum the moments of the points of the tree located strictly inside the ball (query, radius)
+///
+/// Inner nodes fully included in the ball are aggregated in O(1) using their moments (see #MyKdTreeDense), so only
+/// the nodes crossing the ball boundary are traversed down to their points.
+inline KdTreeMoments
+aggregateMoments(const KdTree& tree, const DataPoint::VectorType& query, DataPoint::Scalar radius) {
+    using NodeIndexType = typename KdTree::NodeIndexType;
+    KdTreeMoments res;
+    if (tree.node_count() == 0) return res;
+
+    const auto sqRadius = radius * radius;
+    std::array<NodeIndexType, 2 * 32 + 2> stack; // 2*Traits::MAX_DEPTH + 2
+    int top = 0;
+    stack[top++] = 0;
+    while (top != 0) {
+        const auto& node = tree.nodes()[stack[--top]];
+        if (node.is_leaf()) {
+            const auto end = node.leaf_start() + node.leaf_size();
+            for (auto i = node.leaf_start(); i < end; ++i) {
+                const auto& p = tree.points()[tree.samples()[i]];
+                if ((p.pos() - query).squaredNorm() < sqRadius)
+                    res.addPoint(p, p.weight());
+            }
+        } else {
+            const auto aabb = *node.getAabb();
+            if (aabb.squaredExteriorDistance(query) >= sqRadius) continue;
+            // farthest corner of the box inside the ball: take the whole subtree
+            const DataPoint::VectorType farthest = (query - aabb.min()).cwiseAbs().cwiseMax((query - aabb.max()).cwiseAbs());
+            if (farthest.squaredNorm() < sqRadius) {
+                res += *node.getMoments();
+            } else {
+                stack[top++] = node.inner_first_child_id();
+                stack[top++] = node.inner_first_child_id() + 1;
+            }
+        }
+    }
+    return res;
+}
+
+/// Algebraic hypersphere \f$u_c + u_l.q + u_q |q|^2\f$, with \f$q = x - c\f$, fitted from aggregated #NodeMoments
+///
+/// Mimics the subset of the Ponca fitting API used by the drawing passes, with constant weights.
+struct MomentAlgebraicSphere {
+    using Scalar     = typename DataPoint::Scalar;
+    using VectorType = typename DataPoint::VectorType;
+    using Moments    = KdTreeMoments;
+    using MScalar    = typename Moments::Scalar;
+    using MVectorType= typename Moments::VectorType;
+
+    /// Set the basis center and reset the primitive
+    inline void init(const VectorType& center) {
+        m_center = center;
+        m_uc = m_uq = Scalar(0);
+        m_ul = VectorType::Zero();
+        m_isNormalized = false;
+        m_eCurrentState = Ponca::UNDEFINED;
+        m_nbNeighbors = 0;
+    }
+
+    [[nodiscard]] inline bool isStable() const { return m_eCurrentState == Ponca::STABLE; }
+    [[nodiscard]] inline Ponca::FIT_RESULT getCurrentState() const { return m_eCurrentState; }
+    [[nodiscard]] inline int getNumNeighbors() const { return m_nbNeighbors; }
+    [[nodiscard]] inline bool isSigned() const { return true; }
+
+    [[nodiscard]] inline Scalar potential(const VectorType& x) const {
+        const VectorType q = x - m_center;
+        return m_uc + q.dot(m_ul) + m_uq * q.squaredNorm();
+    }
+
+    [[nodiscard]] inline VectorType primitiveGradient(const VectorType& x) const {
+        return m_ul + Scalar(2) * m_uq * (x - m_center);
+    }
+
+    /// Orthogonal projection on the primitive, see Ponca::AlgebraicSphere::project
+    [[nodiscard]] inline VectorType project(const VectorType& x) const {
+        const VectorType q = x - m_center;
+        const Scalar pot = m_uc + q.dot(m_ul) + m_uq * q.squaredNorm();
+        const VectorType grad = m_ul + Scalar(2) * m_uq * q;
+        const Scalar norm = grad.norm();
+        Scalar t;
+        if (isPlane()) t = - pot / (norm * norm);
+        else           t = - (norm - std::sqrt(norm * norm - Scalar(4) * m_uq * pot)) / (Scalar(2) * m_uq * norm);
+        return m_center + q + t * grad;
+    }
+
+    inline void applyPrattNorm() {
+        if (! m_isNormalized) {
+            const Scalar pn = std::sqrt(m_ul.squaredNorm() - Scalar(4) * m_uc * m_uq);
+            m_uc /= pn;
+            m_ul /= pn;
+            m_uq /= pn;
+            m_isNormalized = true;
+        }
+    }
+
+    [[nodiscard]] inline bool isPlane() const {
+        return Eigen::internal::isMuchSmallerThan(m_uq, Scalar(1));
+    }
+
+    /// Center of the sphere, see Ponca::AlgebraicSphere::center
+    [[nodiscard]] inline VectorType center() const {
+        return m_center + (Scalar(-0.5) / m_uq) * m_ul;
+    }
+
+    /// Radius of the sphere, infinity for planes
+    [[nodiscard]] inline Scalar radius() const {
+        if (isPlane()) return std::numeric_limits<Scalar>::infinity();
+        const Scalar b = Scalar(1) / m_uq;
+        return std::sqrt(((Scalar(-0.5) * b) * m_ul).squaredNorm() - m_uc * b);
+    }
+
+protected:
+    /// Check the number of neighbors and center the moments on the basis center
+    inline bool prepare(const Moments& moments, Moments& local) {
+        m_nbNeighbors = int(moments.m_count);
+        if (moments.m_count == 0) { m_eCurrentState = Ponca::UNDEFINED; return false; }
+        if (moments.m_count < DataPoint::Dim + 1) { m_eCurrentState = Ponca::UNSTABLE; return false; }
+        local = moments.centered(m_center.template cast<MScalar>());
+        return true;
+    }
+    inline void setParameters(MScalar uc, const MVectorType& ul, MScalar uq) {
+        m_uc = Scalar(uc);
+        m_ul = ul.template cast<Scalar>();
+        m_uq = Scalar(uq);
+        m_eCurrentState = Ponca::STABLE;
+    }
+
+    VectorType m_center {VectorType::Zero()};
+    Scalar m_uc {0}, m_uq {0};
+    VectorType m_ul {VectorType::Zero()};
+    bool m_isNormalized {false};
+    Ponca::FIT_RESULT m_eCurrentState {Ponca::UNDEFINED};
+    int m_nbNeighbors {0};
+};
+
+/// Covariance plane fit from moments, equivalent to #ConstPlaneFit
+struct MomentPlaneFit : public MomentAlgebraicSphere {
+    inline Ponca::FIT_RESULT computeWithMoments(const Moments& moments) {
+        Moments local;
+        if (! prepare(moments, local)) return m_eCurrentState;
+        const MScalar invW = MScalar(1) / local.m_sumW;
+        const MVectorType barycenter = local.m_sumP * invW;
+        const typename Moments::MatrixType cov = local.m_sumPPt * invW - barycenter * barycenter.transpose();
+        Eigen::SelfAdjointEigenSolver<typename Moments::MatrixType> solver(cov);
+        const MVectorType n = solver.eigenvectors().col(0);
+        setParameters(- n.dot(barycenter), n, MScalar(0));
+        m_isNormalized = true;
+        return m_eCurrentState;
+    }
+};
+
+/// Algebraic sphere fit with Pratt constraint from moments, equivalent to #ConstSphereFit
+struct MomentSphereFit : public MomentAlgebraicSphere {
+    inline Ponca::FIT_RESULT computeWithMoments(const Moments& moments) {
+        enum {Dim = DataPoint::Dim};
+        using MatrixA = Eigen::Matrix<MScalar, Dim+2, Dim+2>;
+        using VectorA = Eigen::Matrix<MScalar, Dim+2, 1>;
+
+        Moments local;
+        if (! prepare(moments, local)) return m_eCurrentState;
+
+        // sum of [1 q |q|^2] [1 q |q|^2]^T
+        MatrixA matA;
+        matA(0, 0) = local.m_sumW;
+        matA.template block<1, Dim>(0, 1) = local.m_sumP.transpose();
+        matA(0, Dim+1) = local.m_sumDotPP;
+        matA.template block<Dim, Dim>(1, 1) = local.m_sumPPt;
+        matA.template block<Dim, 1>(1, Dim+1) = local.m_sumPPP;
+        matA(Dim+1, Dim+1) = local.m_sumPPPP;
+        matA = matA.template selfadjointView<Eigen::Upper>();
+
+        // inverse of the Pratt constraint matrix
+        MatrixA invCpratt = MatrixA::Identity();
+        invCpratt(0, 0) = invCpratt(Dim+1, Dim+1) = MScalar(0);
+        invCpratt(0, Dim+1) = invCpratt(Dim+1, 0) = MScalar(-0.5);
+
+        Eigen::EigenSolver<MatrixA> solver(invCpratt * matA);
+        const VectorA eivals = solver.eigenvalues().real();
+        int minId = -1;
+        for (int i = 0; i < Dim+2; ++i) {
+            if (eivals(i) > MScalar(0) && (minId == -1 || eivals(i) < eivals(minId)))
+                minId = i;
+        }
+        if (minId == -1) return m_eCurrentState = Ponca::UNSTABLE;
+
+        const VectorA u = solver.eigenvectors().col(minId).real();
+        setParameters(u(0), u.template segment<Dim>(1), u(Dim+1));
+        return m_eCurrentState;
+    }
+};
+
+/// Oriented algebraic sphere fit from moments, equivalent to #ConstOrientedSphereFit
+struct MomentOrientedSphereFit : public MomentAlgebraicSphere {
+    inline Ponca::FIT_RESULT computeWithMoments(const Moments& moments) {
+        Moments local;
+        if (! prepare(moments, local)) return m_eCurrentState;
+
+        const MScalar invW = MScalar(1) / local.m_sumW;
+        const MScalar nume = local.m_sumDotPN - invW * local.m_sumP.dot(local.m_sumN);
+        const MScalar den1 = invW * local.m_sumP.dot(local.m_sumP);
+        const MScalar deno = local.m_sumDotPP - den1;
+
+        if (std::abs(deno) < Eigen::NumTraits<MScalar>::dummy_precision() * std::max(local.m_sumDotPP, den1)) {
+            // degenerate case: fit a plane orthogonal to the mean normal
+            const MVectorType ul = local.m_sumN * invW;
+            // normals cancel out: no plane orientation
+            if (ul.norm() < Eigen::NumTraits<MScalar>::dummy_precision()) return m_eCurrentState = Ponca::UNSTABLE;
+            const MScalar s = MScalar(1) / ul.norm();
+            setParameters(- s * ul.dot(local.m_sumP * invW), s * ul, MScalar(0));
+        } else {
+            const MScalar uq = MScalar(.5) * nume / deno;
+            const MVectorType ul = (local.m_sumN - local.m_sumP * (MScalar(2) * uq)) * invW;
+            const MScalar uc = - invW * (ul.dot(local.m_sumP) + local.m_sumDotPP * uq);
+            setParameters(uc, ul, uq);
+        }
+        return m_eCurrentState;
+    }
+};
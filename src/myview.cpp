@@ -1,16 +1,32 @@
 #include "myview.h"
 
 #include <nanogui/texture.h>
+#include <nanogui/opengl.h> // GLFW_MOD_SHIFT and nanovg
+
+#include <algorithm>
 
 
 using namespace nanogui;
 
+namespace {
+    /// Rotate the normal of a point by angle (in radians)
+    inline void rotateNormal(PointRecord& p, float angle) {
+        const float c = std::cos(angle);
+        const float s = std::sin(angle);
+        const float nx = p[2], ny = p[3];
+        p[2] = c * nx - s * ny;
+        p[3] = s * nx + c * ny;
+    }
+}
+
 MyView::MyView(nanogui::Widget *parent, DataManager* mgr) : ImageView(parent), m_dataMgr(mgr) {
     std::cout<< "Controls:\n"
              << "  scroll: zoom in/out\n"
-             << "  left click: move point\n"
-             << "  right click + move: rotate point normal"
-             << "  ctrl+click: invert normal\n"
+             << "  left click: move point (or selection)\n"
+             << "  right click + move: rotate point normal (or selection)"
+             << "  ctrl+click: invert normal (or selection normals)\n"
+             << "  shift+click + move: rectangle selection\n"
+             << "  alt+click + move: lasso selection\n"
              << std::endl;
 }
 
@@ -36,72 +52,206 @@ MyView::fitImage() {
     return true;
 }
 
-//#define USE_KDTREE
 int
 MyView::findPointId(const Vector2f &lp) const{
-    const auto& points = m_dataMgr->getPointContainer();
-    if(! points.empty()) {
-        int i = 0;
-#ifndef USE_KDTREE
-        for(const auto&p : points) {
-            Vector2f query(p.x(), p.y());
-            if (norm((lp - query)) <= m_selectionThreshold)
-                return i;
-            ++i;
-        }
-#else
+    const auto& tree = m_dataMgr->getKdTree();
+    if(tree.point_count() != 0) {
         DataPoint::VectorType query(lp.x(), lp.y());
-        const auto& tree = m_dataMgr->getKdTree();
         auto res = tree.nearest_neighbor(query);
         if (res.begin() != res.end() &&
-           (query-tree.point_data()[res.get()].pos()).norm()<m_selectionThreshold)
+           (query-tree.points()[res.get()].pos()).norm() <= m_selectionThreshold)
             return res.get();
-#endif
     }
     return -1;
 }
 
+void
+MyView::selectRectangle(const Vector2f &corner1, const Vector2f &corner2) {
+    using AabbType = typename DataManager::KdTree::NodeType::AabbType;
+    AabbType box;
+    box.extend(DataPoint::VectorType(corner1.x(), corner1.y()));
+    box.extend(DataPoint::VectorType(corner2.x(), corner2.y()));
+
+    m_selection.clear();
+    processPointsInBox(m_dataMgr->getKdTree(), box, [this](int pid) { m_selection.push_back(pid); });
+    std::sort(m_selection.begin(), m_selection.end());
+    std::cout << "MyView::select " << m_selection.size() << " points" << std::endl;
+}
+
+void
+MyView::selectLasso(const std::vector<Vector2f> &polygon) {
+    m_selection.clear();
+    if (polygon.size() < 3) return;
+
+    using AabbType = typename DataManager::KdTree::NodeType::AabbType;
+    AabbType box;
+    for (const auto& v : polygon)
+        box.extend(DataPoint::VectorType(v.x(), v.y()));
+
+    // candidates from the bounding box, then even-odd rule
+    const auto& tree = m_dataMgr->getKdTree();
+    processPointsInBox(tree, box, [this, &tree, &polygon](int pid) {
+        const auto& p = tree.points()[pid].pos();
+        bool inside = false;
+        for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+            const auto& a = polygon[i];
+            const auto& b = polygon[j];
+            if (((a.y() > p.y()) != (b.y() > p.y())) &&
+                (p.x() < (b.x() - a.x()) * (p.y() - a.y()) / (b.y() - a.y()) + a.x()))
+                inside = !inside;
+        }
+        if (inside) m_selection.push_back(pid);
+    });
+    std::sort(m_selection.begin(), m_selection.end());
+    std::cout << "MyView::select " << m_selection.size() << " points" << std::endl;
+}
+
+void
+MyView::validateSelection() {
+    const int nbPoints = int(m_dataMgr->getPointContainer().size());
+    m_selection.erase(std::remove_if(m_selection.begin(), m_selection.end(),
+                                     [nbPoints](int id) { return id >= nbPoints; }),
+                      m_selection.end());
+}
+
+bool
+MyView::isSelected(int pointId) const {
+    return std::binary_search(m_selection.begin(), m_selection.end(), pointId);
+}
+
+void
+MyView::translateSelection(const Vector2f &delta) {
+    auto& points = m_dataMgr->getPointContainer();
+    for (int id : m_selection) {
+        points[id].x() += delta.x();
+        points[id].y() += delta.y();
+    }
+    m_dataMgr->updateKdTree();
+}
+
+void
+MyView::rotateSelection(float angle) {
+    auto& points = m_dataMgr->getPointContainer();
+    Vector2f center (0.f, 0.f);
+    for (int id : m_selection)
+        center += Vector2f(points[id].x(), points[id].y());
+    center /= float(m_selection.size());
+
+    const float c = std::cos(angle);
+    const float s = std::sin(angle);
+    for (int id : m_selection) {
+        auto& p = points[id];
+        const Vector2f local (p.x() - center.x(), p.y() - center.y());
+        p.x() = center.x() + c * local.x() - s * local.y();
+        p.y() = center.y() + s * local.x() + c * local.y();
+        rotateNormal(p, angle);
+    }
+    m_dataMgr->updateKdTree();
+}
+
 bool
 MyView::mouse_button_event(const Vector2i &p, int button, bool down, int modifiers)
 {
+    validateSelection();
     auto lp = pos_to_pixel(p - m_pos);
+
+    // end of selection
+    if (!down && m_selectionMode != NO_SELECTION) {
+        if (m_selectionMode == RECTANGLE_SELECTION)
+            selectRectangle(m_selectionPath.front(), m_selectionPath.back());
+        else
+            selectLasso(m_selectionPath);
+        m_selectionMode = NO_SELECTION;
+        m_selectionPath.clear();
+        return true;
+    }
+
     // left click, on press
     if (down && isInsideImage(lp)) {
+        if (modifiers == GLFW_MOD_SHIFT || modifiers == GLFW_MOD_ALT) { // start selection
+            m_selectionMode = modifiers == GLFW_MOD_SHIFT ? RECTANGLE_SELECTION : LASSO_SELECTION;
+            m_selectionPath.assign(modifiers == GLFW_MOD_SHIFT ? 2 : 1, lp);
+            return true;
+        }
+
         auto pointId = findPointId(lp);
         if (modifiers == 0) { // no modified
             if (pointId < 0) {
+                m_selection.clear();
                 if (button == 0) { // create new point iif left click (button id seems to be different wrt drag event
                     std::cout << "MyView::add new point" << std::endl;
-                    m_dataMgr->getPointContainer().emplace_back(lp.x(), lp.y(), DEFAULT_POINT_ANGLE);
+                    m_dataMgr->getPointContainer().push_back(DataManager::makePoint(lp.x(), lp.y(), DEFAULT_POINT_ANGLE));
                     m_dataMgr->updateKdTree();
                 }
+            } else if (isSelected(pointId)) {
+                m_movingSelection = true;
+                m_lastDragPos = lp;
             } else {
+                m_selection.clear();
                 m_movedPoint = pointId;
             }
         } else if (modifiers == 2) { // Ctrl
             if (pointId >= 0) {
-                std::cout << "Flip normal of point " << pointId << std::endl;
-                auto& angle = m_dataMgr->getPointContainer()[pointId].z();
-                angle = float(std::fmod(angle + M_PI, 2.*M_PI));
+                auto& points = m_dataMgr->getPointContainer();
+                auto flip = [&points](int id) { points[id].tail<2>() *= -1.f; };
+                if (isSelected(pointId)) {
+                    std::cout << "Flip normal of " << m_selection.size() << " points" << std::endl;
+                    for (int id : m_selection) flip(id);
+                } else {
+                    std::cout << "Flip normal of point " << m_dataMgr->originalId(pointId) << std::endl;
+                    flip(pointId);
+                }
                 m_dataMgr->updateKdTree();
             }
         }
         return true;
     }
     m_movedPoint = -1;
+    m_movingSelection = false;
     return ImageView::mouse_button_event(p, button, down, modifiers);
 }
 
 bool
 MyView::mouse_drag_event(const nanogui::Vector2i &p, const nanogui::Vector2i &rel, int button, int modifiers)
 {
+    if (m_selectionMode != NO_SELECTION) {
+        auto lp = pos_to_pixel(p - m_pos);
+        if (m_selectionMode == RECTANGLE_SELECTION)
+            m_selectionPath.back() = lp;
+        else if (norm(lp - m_selectionPath.back()) >= 1.f)
+            m_selectionPath.push_back(lp);
+        return true;
+    }
+
     if (modifiers == 2) //control
         return ImageView::mouse_drag_event(p, rel, button, modifiers);
 
     auto lp = pos_to_pixel(p - m_pos);
     if (isInsideImage(lp))
     {
-        if (m_movedPoint>=0) {
+        // relative angle used to rotate normals with right click
+        auto relAngle = [&rel]() {
+            int dist = std::min(std::abs(rel.x()), 50);
+            if (rel.x() < 0) dist *=-1;
+            return std::asin(float(dist) / 50.1f); // move by 40px to get 90 degree angle
+        };
+
+        if (m_movingSelection) {
+            validateSelection();
+            if (m_selection.empty()) return true;
+            switch (button) {
+                case 1: //left click
+                    translateSelection(lp - m_lastDragPos);
+                    m_lastDragPos = lp;
+                    break;
+                case 2: //right click
+                    rotateSelection(relAngle());
+                    break;
+                default:
+                    break;
+            }
+        }
+        else if (m_movedPoint>=0) {
             auto& points = m_dataMgr->getPointContainer();
             switch (button) {
                 case 1: //left click
@@ -113,12 +263,8 @@ MyView::mouse_drag_event(const nanogui::Vector2i &p, const nanogui::Vector2i &re
                     break;
                 case 2: //right click
                 {
-                    int dist = std::min(std::abs(rel.x()), 50);
-                    if (rel.x() < 0) dist *=-1;
                     // if is on a point
-                    auto relAngle = std::asin(float(dist) / 50.1f); // move by 40px to get 90 degree angle
-                    points[m_movedPoint].z() += relAngle;
-//                    std::cout << "Change normal by " << rel << ". Gives angle " << m_points[m_movedPoint].z() << std::endl;
+                    rotateNormal(points[m_movedPoint], relAngle());
                     m_dataMgr->updateKdTree();
                 }
                     break;
@@ -129,3 +275,50 @@ MyView::mouse_drag_event(const nanogui::Vector2i &p, const nanogui::Vector2i &re
     }
     return true;
 }
+
+void
+MyView::draw(NVGcontext *ctx)
+{
+    ImageView::draw(ctx);
+    validateSelection();
+    if (m_selection.empty() && m_selectionMode == NO_SELECTION) return;
+
+    nvgSave(ctx);
+    nvgIntersectScissor(ctx, m_pos.x(), m_pos.y(), m_size.x(), m_size.y());
+    auto toScreen = [this](float x, float y) { return Vector2f(m_pos) + pixel_to_pos(Vector2f(x, y)); };
+
+    // selected points
+    if (! m_selection.empty()) {
+        const auto& points = m_dataMgr->getPointContainer();
+        nvgBeginPath(ctx);
+        for (int id : m_selection) {
+            auto sp = toScreen(points[id].x(), points[id].y());
+            nvgCircle(ctx, sp.x(), sp.y(), 4.f);
+        }
+        nvgStrokeColor(ctx, nvgRGBA(255, 128, 0, 255));
+        nvgStrokeWidth(ctx, 1.5f);
+        nvgStroke(ctx);
+    }
+
+    // selection path
+    if (m_selectionMode != NO_SELECTION && ! m_selectionPath.empty()) {
+        nvgBeginPath(ctx);
+        if (m_selectionMode == RECTANGLE_SELECTION) {
+            auto a = toScreen(m_selectionPath.front().x(), m_selectionPath.front().y());
+            auto b = toScreen(m_selectionPath.back().x(), m_selectionPath.back().y());
+            nvgRect(ctx, std::min(a.x(), b.x()), std::min(a.y(), b.y()), std::abs(b.x() - a.x()), std::abs(b.y() - a.y()));
+        } else {
+            auto a = toScreen(m_selectionPath.front().x(), m_selectionPath.front().y());
+            nvgMoveTo(ctx, a.x(), a.y());
+            for (const auto& v : m_selectionPath) {
+                auto sp = toScreen(v.x(), v.y());
+                nvgLineTo(ctx, sp.x(), sp.y());
+            }
+            nvgClosePath(ctx);
+        }
+        nvgStrokeColor(ctx, nvgRGBA(255, 128, 0, 255));
+        nvgStrokeWidth(ctx, 1.f);
+        nvgStroke(ctx);
+    }
+    nvgRestore(ctx);
+}
@@ -24,6 +24,16 @@ public:
     // \see m_selectionThreshold
     int findPointId(const nanogui::Vector2f &lp) const;
 
+    /// Ids of the selected points
+    inline const std::vector<int>& selection() const { return m_selection; }
+    inline void clearSelection() { m_selection.clear(); }
+
+    /// Select the points inside the rectangle defined by two corners (image coordinates)
+    void selectRectangle(const nanogui::Vector2f &corner1, const nanogui::Vector2f &corner2);
+
+    /// Select the points inside a polygon (image coordinates)
+    void selectLasso(const std::vector<nanogui::Vector2f> &polygon);
+
     // Widget implementation
     /// Handle a mouse button event
     bool mouse_button_event(const nanogui::Vector2i &p, int button, bool down, int modifiers) override;
@@ -34,11 +44,35 @@ public:
     /// Disable scrolling
     inline bool scroll_event(const nanogui::Vector2i &p, const nanogui::Vector2f &rel) override {return true;}
 
+    /// Draw the image, the selected points and the selection path
+    void draw(NVGcontext *ctx) override;
+
     /// Set selection threshold
     inline void setSelectionThreshold(float dist) { m_selectionThreshold = dist; }
 
 private:
+    enum SelectionMode {
+        NO_SELECTION,
+        RECTANGLE_SELECTION,
+        LASSO_SELECTION
+    };
+
+    /// Remove ids that are not valid anymore (e.g. after loading a new point cloud)
+    void validateSelection();
+    bool isSelected(int pointId) const;
+
+    /// Move the selected points, and update the spatial index once
+    void translateSelection(const nanogui::Vector2f &delta);
+    /// Rotate the selected points and their normals around their barycenter, and update the spatial index once
+    void rotateSelection(float angle);
+
     int m_movedPoint{-1};
     float m_selectionThreshold{2}; // distance in pixel used to select points
     DataManager* m_dataMgr{nullptr};
+
+    std::vector<int> m_selection;                   ///< ids of the selected points
+    SelectionMode m_selectionMode{NO_SELECTION};    ///< selection being drawn
+    std::vector<nanogui::Vector2f> m_selectionPath; ///< rectangle corners or lasso polygon, in image coordinates
+    bool m_movingSelection{false};                  ///< dragging the selected points
+    nanogui::Vector2f m_lastDragPos;
 };
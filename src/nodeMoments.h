@@ -0,0 +1,81 @@
+#pragma once
+
+#include <Eigen/Core>
+
+/// Constant-weight moments of a set of oriented points
+///
+/// Each point may stand for several input points (see DataPoint::weight): sums are weighted accordingly.
+///
+/// Sums are expressed in the global frame, so that the moments of disjoint sets can be merged with `+=`: this is how
+/// the kd-tree aggregates its inner nodes (see #MyKdTreeInnerNode). Use #centered to express them in the local frame
+/// of an evaluation point before fitting (see momentFit.h).
+///
+/// \note Computations are expected to be done in double precision: the highest order moments grow as \f$|p|^4\f$.
+template <typename _Scalar, int _Dim>
+struct NodeMoments {
+    using Scalar     = _Scalar;
+    enum {Dim = _Dim};
+    using VectorType = Eigen::Matrix<Scalar, Dim, 1>;
+    using MatrixType = Eigen::Matrix<Scalar, Dim, Dim>;
+
+    int        m_count    {0};                  ///< Number of points
+    Scalar     m_sumW     {0};                  ///< \f$\sum w\f$, the number of input points
+    VectorType m_sumP     {VectorType::Zero()}; ///< \f$\sum p\f$
+    VectorType m_sumN     {VectorType::Zero()}; ///< \f$\sum n\f$
+    Scalar     m_sumDotPN {0};                  ///< \f$\sum p.n\f$
+    Scalar     m_sumDotPP {0};                  ///< \f$\sum |p|^2\f$
+    MatrixType m_sumPPt   {MatrixType::Zero()}; ///< \f$\sum p p^T\f$
+    VectorType m_sumPPP   {VectorType::Zero()}; ///< \f$\sum |p|^2 p\f$
+    Scalar     m_sumPPPP  {0};                  ///< \f$\sum |p|^4\f$
+
+    /// Add a point of weight w to the set. Point must provide pos() and normal()
+    template <typename Point>
+    inline void addPoint(const Point& pt, Scalar w = Scalar(1)) {
+        const VectorType p = pt.pos().template cast<Scalar>();
+        const VectorType n = pt.normal().template cast<Scalar>();
+        const Scalar pp = p.squaredNorm();
+        ++m_count;
+        m_sumW     += w;
+        m_sumP     += w * p;
+        m_sumN     += w * n;
+        m_sumDotPN += w * p.dot(n);
+        m_sumDotPP += w * pp;
+        m_sumPPt   += w * p * p.transpose();
+        m_sumPPP   += w * pp * p;
+        m_sumPPPP  += w * pp * pp;
+    }
+
+    /// Merge the moments of a disjoint set
+    inline NodeMoments& operator+=(const NodeMoments& o) {
+        m_count    += o.m_count;
+        m_sumW     += o.m_sumW;
+        m_sumP     += o.m_sumP;
+        m_sumN     += o.m_sumN;
+        m_sumDotPN += o.m_sumDotPN;
+        m_sumDotPP += o.m_sumDotPP;
+        m_sumPPt   += o.m_sumPPt;
+        m_sumPPP   += o.m_sumPPP;
+        m_sumPPPP  += o.m_sumPPPP;
+        return *this;
+    }
+
+    /// Express the moments with respect to \f$c\f$, ie. compute the sums over \f$q = p - c\f$
+    [[nodiscard]] inline NodeMoments centered(const VectorType& c) const {
+        const Scalar w  = m_sumW;
+        const Scalar cc = c.squaredNorm();
+        const VectorType sumPPtc = m_sumPPt * c;
+        NodeMoments res;
+        res.m_count    = m_count;
+        res.m_sumW     = m_sumW;
+        res.m_sumP     = m_sumP - w * c;
+        res.m_sumN     = m_sumN;
+        res.m_sumDotPN = m_sumDotPN - c.dot(m_sumN);
+        res.m_sumDotPP = m_sumDotPP - Scalar(2) * c.dot(m_sumP) + w * cc;
+        res.m_sumPPt   = m_sumPPt - c * m_sumP.transpose() - m_sumP * c.transpose() + w * c * c.transpose();
+        res.m_sumPPP   = m_sumPPP - m_sumDotPP * c - Scalar(2) * sumPPtc + Scalar(2) * c.dot(m_sumP) * c
+                       + cc * m_sumP - w * cc * c;
+        res.m_sumPPPP  = m_sumPPPP + Scalar(4) * c.dot(sumPPtc) + w * cc * cc - Scalar(4) * c.dot(m_sumPPP)
+                       + Scalar(2) * cc * m_sumDotPP - Scalar(4) * cc * c.dot(m_sumP);
+        return res;
+    }
+};
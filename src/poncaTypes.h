@@ -2,8 +2,30 @@
 
 #include <Ponca/Fitting>
 
+#include "nodeMoments.h"
+
 #include <optional>
+#include <type_traits>
+#include <utility> //pair
+#include <vector>
+
+/// Point attributes as stored in the application: x, y, nx, ny, with unit normals
+using PointRecord = Eigen::Matrix<float, 4, 1>;
+
+/// Point of a level of detail, standing for weight input points (see DataManager::getLevelOfDetail)
+struct WeightedPointRecord {
+    PointRecord record;
+    float weight {1};
+};
 
+/// Ponca point type: lightweight view on a #PointRecord, that must outlive the view
+///
+/// The kd-tree stores one view (a pointer and a weight) per point instead of a copy of the attributes, so it is cheap
+/// to rebuild. Views dangle as soon as the point buffer reallocates: after adding or removing points, the tree must be rebuilt
+/// before any use (see DataManager::updateKdTree).
+///
+/// Views also carry the number of input points the point stands for: 1, except on levels of detail
+/// (see #WeightedPointRecord). The fits scale the weight of each neighbor by this number (see #PointWeightFunc).
 class DataPoint
 {
 public:
@@ -11,17 +33,33 @@ public:
     using Scalar = float;
     using VectorType = Eigen::Vector<Scalar,Dim>;
     using MatrixType = Eigen::Matrix<Scalar,Dim,Dim>;
-    [[nodiscard]] inline const auto& pos() const {return m_pos;}
-    [[nodiscard]] inline const auto& normal() const {return m_normal;}
-    /// \fixme Use maps to avoid duplication
-    explicit inline DataPoint(const nanogui::Vector3f &pn)
-            : m_pos({pn.x(), pn.y()}), m_normal({std::cos(pn.z()), std::sin(pn.z())}) {}
+    [[nodiscard]] inline Eigen::Map<const VectorType> pos() const {return Eigen::Map<const VectorType>(m_data);}
+    [[nodiscard]] inline Eigen::Map<const VectorType> normal() const {return Eigen::Map<const VectorType>(m_data + Dim);}
+    [[nodiscard]] inline Scalar weight() const {return m_weight;}
+    explicit inline DataPoint(const PointRecord &pn) : m_data(pn.data()) {}
+    explicit inline DataPoint(const WeightedPointRecord &pn) : m_data(pn.record.data()), m_weight(pn.weight) {}
 private:
-    VectorType m_pos, m_normal;
+    const Scalar* m_data {nullptr};
+    Scalar m_weight {1};
 };
 
-using WeightFunc = Ponca::DistWeightFunc<DataPoint,Ponca::SmoothWeightKernel<typename DataPoint::Scalar> >;
-using ConstWeightFunc = Ponca::DistWeightFunc<DataPoint,Ponca::ConstantWeightKernel<typename DataPoint::Scalar> >;
+/// Distance weight function, multiplied by the weight of each point (see DataPoint::weight)
+template <class DataPoint, class WeightKernel>
+struct PointWeightFunc : public Ponca::DistWeightFunc<DataPoint, WeightKernel> {
+    using Base = Ponca::DistWeightFunc<DataPoint, WeightKernel>;
+    using VectorType = typename Base::VectorType;
+    using Base::Base;
+
+    inline auto w(const VectorType& q, const DataPoint& attributes) const {
+        auto res = Base::w(q, attributes);
+        if constexpr (std::is_arithmetic_v<decltype(res)>) res *= attributes.weight();
+        else res.first *= attributes.weight(); // weight and local position
+        return res;
+    }
+};
+
+using WeightFunc = PointWeightFunc<DataPoint,Ponca::SmoothWeightKernel<typename DataPoint::Scalar> >;
+using ConstWeightFunc = PointWeightFunc<DataPoint,Ponca::ConstantWeightKernel<typename DataPoint::Scalar> >;
 
 using PlaneFit = Ponca::Basket<DataPoint ,WeightFunc, Ponca::CovariancePlaneFit>;
 using ConstPlaneFit = Ponca::Basket<DataPoint ,ConstWeightFunc, Ponca::CovariancePlaneFit>;
@@ -36,18 +74,25 @@ using UnorientedSphereFit = Ponca::Basket<DataPoint ,WeightFunc, Ponca::Unorient
 
 #include <Ponca/SpatialPartitioning>
 
+/// Inner node storing the bounding box of its subtree
 template <typename NodeIndex, typename Scalar, int DIM, typename _AabbType = Eigen::AlignedBox<Scalar, DIM>>
-struct MyKdTreeInnerNode : public Ponca::KdTreeDefaultInnerNode<NodeIndex, Scalar, DIM> {
+struct MyKdTreeAabbInnerNode : public Ponca::KdTreeDefaultInnerNode<NodeIndex, Scalar, DIM> {
     using AabbType = _AabbType;
     AabbType m_aabb{};
 };
 
-template <typename Index, typename NodeIndex, typename DataPoint, typename LeafSize = Index>
-struct MyKdTreeNode : Ponca::KdTreeCustomizableNode<Index, NodeIndex, DataPoint, LeafSize,
-        MyKdTreeInnerNode<NodeIndex, typename DataPoint::Scalar, DataPoint::Dim>> {
+/// Inner node storing the bounding box and the moments of its subtree
+template <typename NodeIndex, typename Scalar, int DIM, typename _AabbType = Eigen::AlignedBox<Scalar, DIM>>
+struct MyKdTreeInnerNode : public MyKdTreeAabbInnerNode<NodeIndex, Scalar, DIM, _AabbType> {
+    using MomentsType = NodeMoments<double, DIM>;
+    MomentsType m_moments{}; ///< Moments of the points stored in the subtree, see #MyKdTreeDense
+};
 
-    using Base = Ponca::KdTreeCustomizableNode<Index, NodeIndex, DataPoint, LeafSize,
-            MyKdTreeInnerNode<NodeIndex, typename DataPoint::Scalar, DataPoint::Dim>>;
+/// Node giving access to the bounding box of the inner nodes, see #MyKdTreeAabbNode and #MyKdTreeNode
+template <typename Index, typename NodeIndex, typename DataPoint, typename LeafSize, typename InnerNode>
+struct MyKdTreeNodeBase : Ponca::KdTreeCustomizableNode<Index, NodeIndex, DataPoint, LeafSize, InnerNode> {
+
+    using Base = Ponca::KdTreeCustomizableNode<Index, NodeIndex, DataPoint, LeafSize, InnerNode>;
     using AabbType  = typename Base::AabbType;
 
     void configure_range(Index start, Index size, const AabbType &aabb)
@@ -66,4 +111,146 @@ struct MyKdTreeNode : Ponca::KdTreeCustomizableNode<Index, NodeIndex, DataPoint,
     }
 };
 
+/// Node storing the bounding box of the inner nodes only, for trees that do not need the moments (e.g. #KdTree3)
+template <typename Index, typename NodeIndex, typename DataPoint, typename LeafSize = Index>
+struct MyKdTreeAabbNode : MyKdTreeNodeBase<Index, NodeIndex, DataPoint, LeafSize,
+        MyKdTreeAabbInnerNode<NodeIndex, typename DataPoint::Scalar, DataPoint::Dim>> {};
+
+/// Node storing the bounding box and the moments of the inner nodes, see #MyKdTreeDense
+template <typename Index, typename NodeIndex, typename DataPoint, typename LeafSize = Index>
+struct MyKdTreeNode : MyKdTreeNodeBase<Index, NodeIndex, DataPoint, LeafSize,
+        MyKdTreeInnerNode<NodeIndex, typename DataPoint::Scalar, DataPoint::Dim>> {
+
+    using Base = MyKdTreeNodeBase<Index, NodeIndex, DataPoint, LeafSize,
+            MyKdTreeInnerNode<NodeIndex, typename DataPoint::Scalar, DataPoint::Dim>>;
+    using MomentsType = typename MyKdTreeInnerNode<NodeIndex, typename DataPoint::Scalar, DataPoint::Dim>::MomentsType;
+
+    /// Moments of the points stored in the subtree, nullptr for leaves
+    [[nodiscard]] inline const MomentsType* getMoments() const {
+        return Base::is_leaf() ? nullptr : &(Base::getAsInner().m_moments);
+    }
+    inline void setMoments(const MomentsType& moments) {
+        if (! Base::is_leaf())
+            Base::getAsInner().m_moments = moments;
+    }
+};
+
+/// Dense kd-tree storing the moments of its inner nodes
+///
+/// Moments are refreshed after each build, and allow to aggregate entire subtrees in constant-weight fits
+/// (see momentFit.h).
+template <typename Traits>
+struct MyKdTreeDense : public Ponca::KdTreeDenseBase<Traits> {
+    using Base = Ponca::KdTreeDenseBase<Traits>;
+    using MomentsType = typename Traits::NodeType::MomentsType;
+
+    /// Build the tree and compute the node moments
+    template<typename PointUserContainer>
+    inline void build(PointUserContainer&& points) {
+        Base::build(std::forward<PointUserContainer>(points));
+        updateMoments();
+    }
+
+    /// Compute the moments of the nodes from the leaves up to the root
+    inline void updateMoments() {
+        auto& nodes = this->m_nodes;
+        std::vector<MomentsType> moments (nodes.size());
+        // children are always stored after their parent
+        for (auto id = nodes.size(); id-- > 0; ) {
+            auto& node = nodes[id];
+            if (node.is_leaf()) {
+                const auto end = node.leaf_start() + node.leaf_size();
+                for (auto i = node.leaf_start(); i < end; ++i) {
+                    const auto& p = this->m_points[this->m_indices[i]];
+                    moments[id].addPoint(p, p.weight());
+                }
+            } else {
+                moments[id] += moments[node.inner_first_child_id()];
+                moments[id] += moments[node.inner_first_child_id() + 1];
+                node.setMoments(moments[id]);
+            }
+        }
+    }
+};
+
 using KdTree = Ponca::KdTreeBase<Ponca::KdTreeDefaultTraits<DataPoint,MyKdTreeNode>>;
+
+/// Call f(pointId) for each point of the tree located inside box
+///
+/// Uses the bounding boxes of the inner nodes: subtrees outside the box are skipped, and subtrees fully inside the box
+/// are reported without testing their points.
+template <typename Tree, typename Functor>
+inline void processPointsInBox(const Tree& tree, const typename Tree::NodeType::AabbType& box, Functor f) {
+    if (tree.node_count() == 0 || box.isEmpty()) return;
+    std::vector<std::pair<typename Tree::NodeIndexType, bool>> stack {{0, false}}; // node id, is inside box
+    while (! stack.empty()) {
+        const auto [id, inside] = stack.back();
+        stack.pop_back();
+        const auto& node = tree.nodes()[id];
+        if (node.is_leaf()) {
+            const auto end = node.leaf_start() + node.leaf_size();
+            for (auto i = node.leaf_start(); i < end; ++i) {
+                const auto pid = tree.samples()[i];
+                if (inside || box.contains(tree.points()[pid].pos()))
+                    f(pid);
+            }
+        } else {
+            bool childInside = inside;
+            if (! inside) {
+                const auto aabb = *node.getAabb();
+                if (! box.intersects(aabb)) continue;
+                childInside = box.contains(aabb);
+            }
+            stack.emplace_back(node.inner_first_child_id(), childInside);
+            stack.emplace_back(node.inner_first_child_id() + 1, childInside);
+        }
+    }
+}
+
+/// Number of points of the tree located inside box
+///
+/// Inner nodes fully inside the box are counted in O(1) using their moments (see #MyKdTreeDense).
+inline size_t countPointsInBox(const KdTree& tree, const typename KdTree::NodeType::AabbType& box) {
+    if (tree.node_count() == 0 || box.isEmpty()) return 0;
+    size_t count = 0;
+    std::vector<typename KdTree::NodeIndexType> stack {0};
+    while (! stack.empty()) {
+        const auto& node = tree.nodes()[stack.back()];
+        stack.pop_back();
+        if (node.is_leaf()) {
+            const auto end = node.leaf_start() + node.leaf_size();
+            for (auto i = node.leaf_start(); i < end; ++i)
+                if (box.contains(tree.points()[tree.samples()[i]].pos())) ++count;
+        } else {
+            const auto aabb = *node.getAabb();
+            if (! box.intersects(aabb)) continue;
+            if (box.contains(aabb)) {
+                count += size_t(node.getMoments()->m_count);
+                continue;
+            }
+            stack.push_back(node.inner_first_child_id());
+            stack.push_back(node.inner_first_child_id() + 1);
+        }
+    }
+    return count;
+}
+
+/// Number of nodes of the tree visited by a range query of the ball (center, radius)
+///
+/// Inner nodes are descended when their box intersects the ball, and the leaves of a descended node are all visited:
+/// this approximates the traversal of KdTree::range_neighbors, which tests split planes instead of boxes.
+inline size_t countNodesInBall(const KdTree& tree, const DataPoint::VectorType& center, float radius) {
+    if (tree.node_count() == 0) return 0;
+    const float r2 = radius * radius;
+    size_t count = 0;
+    std::vector<typename KdTree::NodeIndexType> stack {0};
+    while (! stack.empty()) {
+        const auto& node = tree.nodes()[stack.back()];
+        stack.pop_back();
+        ++count;
+        if (node.is_leaf() || node.getAabb()->squaredExteriorDistance(center) > r2) continue;
+        stack.push_back(node.inner_first_child_id());
+        stack.push_back(node.inner_first_child_id() + 1);
+    }
+    return count;
+}
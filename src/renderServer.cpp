@@ -0,0 +1,228 @@
+#include "renderServer.h"
+#include "appBase.h"
+
+#include "boundedQueue.h"
+#include "dataManager.h"
+#include "drawingPass.h"
+#include "fieldBuffer.h"
+#include "tileScheduler.h"
+
+#include <algorithm> // max
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace poncaplot {
+    struct RenderServer::Request {
+        std::string id;
+        std::string command;
+        std::string arguments; ///< remaining of the line, after the session name
+    };
+
+    /// Resident state of a cloud, owned by its worker thread
+    struct RenderServer::Session {
+        std::string name;
+        /// Set by the worker when the load creating the session fails: the following requests are rejected, and the
+        /// session is discarded by #run
+        std::atomic<bool> failed{false};
+        bool loaded{false};
+        DataManager data;
+        size_t passId{DataManager::getDrawingPassIndex("MLS - Oriented Sphere")};
+        FillPass fill{{1, 1, 1, 1}};
+        ColorMap cmap{{1, 1, 1, 1}};
+        RenderingContext::Schedule schedule{RenderingContext::COST_AWARE};
+
+        std::vector<float> texture;
+        FieldBuffer fields;
+        std::vector<char> encodeBuffer, png;
+        /// Incremented each time the cloud or a parameter changes, to reuse the last image when possible
+        size_t version{0};
+        using RenderKey = std::tuple<size_t, size_t, size_t, float, float, float>; // version, w, h, x0, y0, scale
+        RenderKey lastRender{~size_t(0), 0, 0, 0.f, 0.f, 0.f};
+
+        BoundedQueue<Request> requests{64};
+        std::thread worker;
+    };
+
+    RenderServer::RenderServer(std::istream &in, std::ostream &out) : m_in(in), m_out(out) {}
+
+    RenderServer::~RenderServer() {
+        for (auto &[name, session]: m_sessions) {
+            session->requests.close();
+            if (session->worker.joinable()) session->worker.join();
+        }
+    }
+
+    void
+    RenderServer::answer(const std::string &line, const char *payload, size_t size) {
+        std::lock_guard<std::mutex> lock(m_outMutex);
+        m_out << line << '\n';
+        if (payload) m_out.write(payload, std::streamsize(size));
+        m_out.flush();
+    }
+
+    void
+    RenderServer::run() {
+        std::string line;
+        while (std::getline(m_in, line)) {
+            std::istringstream is(line);
+            Request request;
+            std::string sessionName;
+            if (!(is >> request.id)) continue; // empty line
+            if (!(is >> request.command)) {
+                answer("error " + request.id + " missing command");
+                continue;
+            }
+            if (request.command == "quit") {
+                answer("ok " + request.id);
+                break;
+            }
+            if (!(is >> sessionName)) {
+                answer("error " + request.id + " missing session name");
+                continue;
+            }
+            std::getline(is >> std::ws, request.arguments);
+
+            auto it = m_sessions.find(sessionName);
+            if (it != m_sessions.end() && it->second->failed) {
+                // the worker already rejects the requests queued after the failed load
+                it->second->requests.close();
+                it->second->worker.join();
+                m_sessions.erase(it);
+                it = m_sessions.end();
+            }
+            if (it == m_sessions.end()) {
+                if (request.command != "load") {
+                    answer("error " + request.id + " unknown session " + sessionName);
+                    continue;
+                }
+                auto session = std::make_unique<Session>();
+                session->name = sessionName;
+                auto *s = session.get();
+                s->worker = std::thread([this, s]() {
+                    while (auto r = s->requests.pop()) {
+                        if (s->failed) answer("error " + r->id + " unknown session " + s->name);
+                        else processRequest(*s, *r);
+                    }
+                });
+                it = m_sessions.emplace(sessionName, std::move(session)).first;
+            }
+
+            const bool closing = request.command == "close";
+            it->second->requests.push(std::move(request));
+            if (closing) {
+                it->second->requests.close();
+                it->second->worker.join();
+                m_sessions.erase(it);
+            }
+        }
+        // pending requests are processed by the destructor
+    }
+
+    void
+    RenderServer::processRequest(Session &session, const Request &request) {
+        try {
+            std::istringstream is(request.arguments);
+            if (request.command == "load") {
+                if (!session.data.loadPointCloud(request.arguments))
+                    throw std::runtime_error("cannot load " + request.arguments);
+                session.data.prepareSpatialIndex();
+                session.loaded = true;
+                ++session.version;
+                answer("ok " + request.id + " " + std::to_string(session.data.getPointContainer().size()) + " points");
+            } else if (request.command == "set") {
+                std::string key, value;
+                is >> key;
+                std::getline(is >> std::ws, value);
+                if (key == "fit")
+                    session.passId = DataManager::getDrawingPassIndex(value);
+                else if (key == "scale" || key == "iter") {
+                    const float v = std::stof(value);
+                    if (key == "scale") session.data.setGridCellSize(v);
+                    session.data.processPasses<BaseFitField>([&key, v](BaseFitField *p) {
+                        if (key == "scale") p->params.m_scale = v;
+                        else p->params.m_iter = std::max(1, int(v));
+                    });
+                } else if (key == "index") {
+                    if (value != "grid" && value != "kdtree")
+                        throw std::runtime_error("unknown index " + value + ", expected kdtree or grid");
+                    session.data.setSpatialIndex(value == "grid" ? DataManager::UNIFORM_GRID : DataManager::KDTREE);
+                } else if (key == "channel")
+                    session.cmap.m_channel = FieldBuffer::channelIndex(value);
+                else if (key == "schedule") {
+                    size_t s = 0;
+                    while (s != RenderingContext::scheduleNames.size() && RenderingContext::scheduleNames[s] != value)
+                        ++s;
+                    if (s == RenderingContext::scheduleNames.size())
+                        throw std::runtime_error("unknown schedule " + value);
+                    session.schedule = RenderingContext::Schedule(s);
+                } else if (key == "exact")
+                    session.data.setLevelOfDetail(value == "0");
+                else if (key == "threads")
+                    setRenderThreadCount(std::stoi(value)); // per thread, so per session
+                else
+                    throw std::runtime_error("unknown parameter " + key);
+                ++session.version;
+                answer("ok " + request.id);
+            } else if (request.command == "render") {
+                size_t w = 0, h = 0;
+                float x0 = 0, y0 = 0, scale = 1;
+                std::string output;
+                if (!(is >> w >> h >> x0 >> y0 >> scale >> output) || w == 0 || h == 0 || scale <= 0)
+                    throw std::runtime_error("expected: render <session> <width> <height> <x0> <y0> <pixel size> "
+                                             "<output>");
+
+                const auto start = std::chrono::steady_clock::now();
+                const Session::RenderKey key{session.version, w, h, x0, y0, scale};
+                if (key != session.lastRender) {
+                    session.texture.resize(w * h * 4);
+                    session.data.prepareSpatialIndex(); // after a change of the index or of the scale
+                    RenderingContext ctx{w, h, scale, nullptr}; // grid: see DataManager::renderPass
+                    ctx.schedule = session.schedule;
+                    ctx.x0 = x0;
+                    ctx.y0 = y0;
+                    if (session.cmap.m_channel >= 0) {
+                        session.fields.resize(w, h, 1u << session.cmap.m_channel);
+                        ctx.fields = &session.fields;
+                    }
+                    const auto &points = session.data.getKdTree();
+                    session.fill.render(points, session.texture.data(), ctx);
+                    session.data.renderPass(session.passId, session.texture.data(), ctx);
+                    session.cmap.render(points, session.texture.data(), ctx);
+                    session.lastRender = key;
+                }
+                const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+                if (output == "raw") {
+                    answer("ok " + request.id + " raw " + std::to_string(w) + " " + std::to_string(h) + " " +
+                           std::to_string(session.texture.size() * sizeof(float)),
+                           reinterpret_cast<const char *>(session.texture.data()),
+                           session.texture.size() * sizeof(float));
+                } else if (output == "png") {
+                    session.png.clear();
+                    if (!encode_image(int(w), int(h), session.texture.data(), session.png, session.encodeBuffer))
+                        throw std::runtime_error("cannot encode the image");
+                    answer("ok " + request.id + " png " + std::to_string(session.png.size()),
+                           session.png.data(), session.png.size());
+                } else {
+                    if (!write_image(int(w), int(h), session.texture.data(), output, session.encodeBuffer))
+                        throw std::runtime_error("cannot write " + output);
+                    answer("ok " + request.id + " " + std::to_string(elapsed.count()) + "ms");
+                }
+            } else if (request.command == "close")
+                answer("ok " + request.id);
+            else
+                throw std::runtime_error("unknown command " + request.command);
+        }
+        catch (const std::exception &e) {
+            // a session is created by its first load
+            if (request.command == "load" && !session.loaded) session.failed = true;
+            answer("error " + request.id + " " + e.what());
+        }
+    }
+}
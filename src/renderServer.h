@@ -0,0 +1,51 @@
+#pragma once
+
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace poncaplot {
+    /// Long-running rendering service, reading requests on an input stream and answering on an output stream
+    ///
+    /// Clouds are loaded in named sessions that stay resident between requests, with their spatial indices, drawing
+    /// passes and buffers. Each session runs on its own thread: requests on a session are processed in order, and
+    /// requests on different sessions are processed concurrently.
+    ///
+    /// Protocol: one request per line, `<request id> <command> [arguments]`, with
+    ///   - `load <session> <path>`: load (or reload) a point cloud in a session, created if needed. A session is kept
+    ///     only if its first load succeeds
+    ///   - `set <session> <key> <value>`: key is one of fit (pass name, spaces allowed), scale, iter,
+    ///      index (kdtree|grid), channel (fit or a FieldBuffer channel), schedule (static|dynamic|cost), threads,
+    ///      exact (1, the default: fit the full resolution cloud at all scales, 0: use levels of detail)
+    ///   - `render <session> <width> <height> <x0> <y0> <pixel size> <output>`: render the region of the cloud
+    ///     starting at (x0,y0), in point units. output is a file path (.png), or `png`/`raw` to stream the image
+    ///   - `close <session>`
+    ///   - `quit`
+    ///
+    /// Each request gets one answer line: `ok <request id> [details]` or `error <request id> <message>`. Streamed
+    /// images are sent right after their answer line, `ok <id> png <size>` for a PNG file or
+    /// `ok <id> raw <width> <height> <size>` for linear RGBA float32 pixels.
+    class RenderServer {
+    public:
+        RenderServer(std::istream &in, std::ostream &out);
+        ~RenderServer();
+
+        /// Process requests until `quit` or the end of the input stream, then wait for the pending requests
+        void run();
+
+    private:
+        struct Session;
+        struct Request;
+
+        void processRequest(Session &session, const Request &request);
+        /// Write an answer, and an optional payload, atomically
+        void answer(const std::string &line, const char *payload = nullptr, size_t size = 0);
+
+        std::istream &m_in;
+        std::ostream &m_out;
+        std::mutex m_outMutex;
+        std::map<std::string, std::unique_ptr<Session>> m_sessions;
+    };
+}
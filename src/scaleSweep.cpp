@@ -0,0 +1,141 @@
+#include "scaleSweep.h"
+#include "appBase.h"
+#include "boundedQueue.h"
+#include "drawingPass.h"
+
+#include <algorithm> // max, min
+#include <cmath>     // floor
+#include <iostream>
+#include <type_traits>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace poncaplot {
+    ScaleSweepExport::~ScaleSweepExport() {
+        cancel();
+        wait();
+    }
+
+    bool
+    ScaleSweepExport::start(const DataManager &data, const PassFactory &makePasses, const Settings &settings) {
+        if (m_running) return false;
+        wait();
+        if (settings.scaleStep <= 0 || settings.scaleEnd < settings.scaleStart) return false;
+
+        m_settings = settings;
+        m_frameCount = size_t(std::floor((settings.scaleEnd - settings.scaleStart) / settings.scaleStep)) + 1;
+
+        m_points = data.getPointContainer();
+        if (m_points.empty()) m_tree.clear();
+        else m_tree.build(m_points);
+        m_useGrid = data.getSpatialIndex() == DataManager::UNIFORM_GRID;
+
+        unsigned int nbRender = settings.nbRenderThreads;
+        if (nbRender == 0) nbRender = std::max(2u, std::thread::hardware_concurrency() / 4);
+        nbRender = unsigned(std::min(size_t(nbRender), m_frameCount));
+        m_settings.nbEncoderThreads = std::max(1u, settings.nbEncoderThreads);
+
+        // passes are copied here, from the calling thread, so the caller can keep editing its own instances
+        std::vector<PassSet> passes;
+        for (unsigned int r = 0; r != nbRender; ++r)
+            passes.push_back(makePasses());
+
+        m_cancel = false;
+        m_savedFrames = 0;
+        m_failedFrames = 0;
+        m_running = true;
+        m_thread = std::thread(&ScaleSweepExport::run, this, std::move(passes));
+        return true;
+    }
+
+    void
+    ScaleSweepExport::wait() {
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+    void
+    ScaleSweepExport::run(std::vector<PassSet> passes) {
+        struct EncodeTask {
+            size_t frame;
+            float *texture;
+            BoundedQueue<float *> *pool; // where to give back the texture once saved
+        };
+
+        const size_t w = m_settings.width;
+        const size_t h = m_settings.height;
+        const int nbRender = int(passes.size());
+        BoundedQueue<EncodeTask> encodeQueue(2 * m_settings.nbEncoderThreads);
+        std::atomic<size_t> nextFrame{0};
+
+        std::cout << "Export " << m_frameCount << " frames with " << nbRender << " render threads" << std::endl;
+
+        std::vector<std::thread> encoders;
+        for (unsigned int e = 0; e != m_settings.nbEncoderThreads; ++e)
+            encoders.emplace_back([this, w, h, &encodeQueue]() {
+                std::vector<char> buffer;
+                while (auto task = encodeQueue.pop()) {
+                    const auto path = formatFramePath(m_settings.outputPattern, task->frame);
+                    if (write_image(int(w), int(h), task->texture, path, buffer))
+                        ++m_savedFrames;
+                    else {
+                        std::cerr << "Cannot save " << path << std::endl;
+                        ++m_failedFrames;
+                    }
+                    task->pool->push(task->texture);
+                }
+            });
+
+        std::vector<std::thread> renderers;
+        for (int r = 0; r != nbRender; ++r)
+            renderers.emplace_back([this, w, h, nbRender, &passes, r, &nextFrame, &encodeQueue]() {
+#ifdef _OPENMP
+                // share the cores between the frames rendered concurrently
+                const int nbCores = m_settings.nbThreads > 0 ? int(m_settings.nbThreads) : omp_get_num_procs();
+                omp_set_num_threads(std::max(1, nbCores / nbRender));
+#endif
+                // buffers in flight: one being rendered, one being encoded
+                constexpr size_t nbBuffers = 2;
+                std::vector<std::vector<float>> textures(nbBuffers, std::vector<float>(w * h * 4));
+                BoundedQueue<float *> pool(nbBuffers);
+                for (auto &t: textures) pool.push(t.data());
+
+                UniformGrid grid;
+                FieldBuffer fields; // only used if a ColorMap displays a channel
+                const int channel = m_settings.channel;
+                for (size_t i = nextFrame++; i < m_frameCount && !m_cancel; i = nextFrame++) {
+                    const float scale = m_settings.scaleStart + float(i) * m_settings.scaleStep;
+                    DrawingPassRegistry::visit(m_settings.fitPassId, passes[r].fit, [scale](auto *fit) {
+                        if constexpr (std::is_base_of_v<BaseFitField, std::remove_pointer_t<decltype(fit)>>)
+                            fit->params.m_scale = scale;
+                    });
+                    if (m_useGrid) grid.build(m_tree.points(), scale);
+
+                    RenderingContext ctx {w, h, m_settings.pixelScale, m_useGrid ? &grid : nullptr};
+                    ctx.schedule = m_settings.schedule;
+                    if (channel >= 0) {
+                        fields.resize(w, h, 1u << channel);
+                        ctx.fields = &fields;
+                    }
+                    auto texture = pool.pop();
+                    for (auto &p: passes[r].passes)
+                        p->render(m_tree, *texture, ctx);
+                    encodeQueue.push({i, *texture, &pool});
+                }
+
+                // wait for the encoders to release the textures
+                for (size_t b = 0; b != nbBuffers; ++b) pool.pop();
+            });
+
+        for (auto &t: renderers) t.join();
+        encodeQueue.close();
+        for (auto &t: encoders) t.join();
+
+        std::cout << "Export " << (m_cancel ? "cancelled" : "done") << ": "
+                  << m_savedFrames << "/" << m_frameCount << " frames saved";
+        if (m_failedFrames != 0) std::cout << ", " << m_failedFrames << " failed";
+        std::cout << std::endl;
+        m_running = false;
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "contexts.h"
+#include "dataManager.h"
+
+namespace poncaplot {
+    /// Headless export of one image per fitting scale, running in background threads
+    ///
+    /// Several frames are rendered concurrently, each render thread owning its own pass instances, spatial index and
+    /// buffer pool. Finished frames are handed to a pool of encoder threads. The point cloud is copied when the job
+    /// starts, so the GUI can keep editing it while the job runs.
+    class ScaleSweepExport {
+    public:
+        /// Passes rendered for each frame, in order
+        struct PassSet {
+            std::vector<std::unique_ptr<DrawingPass>> passes;
+            DrawingPass *fit{nullptr}; ///< pass of passes fitted with the scale of the frame, see Settings::fitPassId
+        };
+        /// Build an independent copy of the passes to render, called once per render thread from #start
+        using PassFactory = std::function<PassSet()>;
+
+        struct Settings {
+            float scaleStart{10};
+            float scaleEnd{750};
+            float scaleStep{1};
+            std::string outputPattern{"scale_%04d.png"}; ///< printf-like, see #formatFramePath
+            size_t width{500};
+            size_t height{500};
+            float pixelScale{1.f};                       ///< size of a pixel in point cloud units, see RenderingContext
+            unsigned int nbRenderThreads{0};             ///< 0: automatic
+            unsigned int nbEncoderThreads{2};
+            unsigned int nbThreads{0};                   ///< cores shared by the render threads, 0: all the cores
+            RenderingContext::Schedule schedule{RenderingContext::COST_AWARE};
+            size_t fitPassId{0};                         ///< index of PassSet::fit in DrawingPassRegistry
+            int channel{-1};                             ///< FieldBuffer channel displayed by the passes, -1: none
+        };
+
+        ScaleSweepExport() = default;
+        ~ScaleSweepExport();
+
+        /// Start the job in background
+        /// \return false if a job is already running or if the scale range is empty
+        bool start(const DataManager &data, const PassFactory &makePasses, const Settings &settings);
+
+        /// Ask the job to stop as soon as possible. Frames being rendered are still saved
+        inline void cancel() { m_cancel = true; }
+
+        /// Wait for the end of the job
+        void wait();
+
+        inline bool isRunning() const { return m_running; }
+        inline bool isCancelled() const { return m_cancel; }
+        inline size_t frameCount() const { return m_frameCount; }
+        /// Number of frames saved on disk
+        inline size_t savedFrameCount() const { return m_savedFrames; }
+        /// Number of frames rendered but not saved, because their file could not be written
+        inline size_t failedFrameCount() const { return m_failedFrames; }
+        inline float progress() const {
+            return m_frameCount == 0 ? 1.f : float(m_savedFrames + m_failedFrames) / float(m_frameCount);
+        }
+
+    private:
+        void run(std::vector<PassSet> passes);
+
+        Settings m_settings;
+        DataManager::PointContainer m_points;        ///< copy of the point cloud
+        DataManager::KdTree m_tree;                  ///< index on m_points
+        bool m_useGrid{false};
+
+        std::thread m_thread;
+        std::atomic<bool> m_running{false};
+        std::atomic<bool> m_cancel{false};
+        std::atomic<size_t> m_savedFrames{0};
+        std::atomic<size_t> m_failedFrames{0};
+        size_t m_frameCount{0};
+    };
+}
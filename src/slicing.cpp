@@ -0,0 +1,185 @@
+#include "slicing.h"
+
+#include <algorithm> // sort
+#include <cmath>
+#include <fstream>
+#include <functional> // greater
+#include <iostream>
+#include <iterator>
+#include <numeric> // iota
+#include <queue>
+#include <sstream>
+#include <tuple>
+#include <utility> //pair
+
+bool
+PointCloud3::load(const std::string& path) {
+    if( path.empty() ) return false;
+
+    const bool binary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".bin") == 0;
+    std::ifstream file (path, binary ? std::ios::in | std::ios::binary : std::ios::in);
+    if( ! file.is_open() ) return false;
+
+    m_points.clear();
+    bool needToComputeNormals = false;
+
+    if (binary) {
+        file.seekg(0, std::ios::end);
+        const auto size = size_t(file.tellg());
+        file.seekg(0, std::ios::beg);
+        if (size % sizeof(PointRecord3) != 0)
+            std::cerr << "Ignoring the last " << size % sizeof(PointRecord3) << " bytes of " << path << std::endl;
+        m_points.resize(size / sizeof(PointRecord3));
+        file.read(reinterpret_cast<char*>(m_points.data()), std::streamsize(m_points.size() * sizeof(PointRecord3)));
+    } else {
+        std::string line;
+        std::vector<float> numbers;
+        while ( getline (file,line) ) {
+            // trim comments
+            std::size_t found = line.find('#');
+            if (found!=std::string::npos)
+                line = line.substr(0,found);
+            if ( line.empty() ) continue;
+
+            numbers.clear();
+            std::istringstream is(line);
+            numbers.assign(std::istream_iterator<float>(is), std::istream_iterator<float>());
+            if (numbers.size() == 3) {
+                m_points.push_back((PointRecord3() << numbers[0], numbers[1], numbers[2], 0.f, 0.f, 1.f).finished());
+                needToComputeNormals = true;
+            } else if (numbers.size() == 6) {
+                PointRecord3 p (numbers.data());
+                p.tail<3>().normalize();
+                m_points.push_back(p);
+            } else
+                std::cerr << "Skipping malformed line: ["  << line << "]" << std::endl;
+        }
+    }
+    file.close();
+
+    updateIndex();
+    if (needToComputeNormals) {
+        computeNormals();
+        orientNormals();
+    }
+
+    std::cout << "Loaded " << m_points.size() << " 3D points" << std::endl;
+    return true;
+}
+
+void
+PointCloud3::updateIndex() {
+    if (m_points.empty()) m_tree.clear();
+    else m_tree.build(m_points);
+    // force the extraction of the next slab
+    m_slabRadius = -1.f;
+    m_slab.clear();
+    m_slabTree.clear();
+}
+
+void
+PointCloud3::fitToSize(float size) {
+    if (m_points.empty()) return;
+    const auto box = boundingBox();
+    const float maxSide = box.sizes().maxCoeff();
+    const float factor = maxSide > 0.f ? size / maxSide : 1.f;
+    const DataPoint3::VectorType center = box.center();
+    for (auto& p : m_points)
+        p.head<3>() = (p.head<3>() - center) * factor;
+    updateIndex();
+}
+
+void
+PointCloud3::orientNormals(int k) {
+    const int nbPoints = int(m_points.size());
+    // seeds of the connected components, highest first
+    std::vector<int> seeds (nbPoints);
+    std::iota(seeds.begin(), seeds.end(), 0);
+    std::sort(seeds.begin(), seeds.end(), [this](int a, int b) { return m_points[a].z() > m_points[b].z(); });
+
+    std::vector<char> visited (nbPoints, 0);
+    using Edge = std::tuple<float, int, int>; // 1 - |cos| of the normals, point, neighbor it is oriented from
+    std::priority_queue<Edge, std::vector<Edge>, std::greater<>> front;
+    for (int seed : seeds) {
+        if (visited[seed]) continue;
+        if (m_points[seed][5] < 0) m_points[seed].tail<3>() *= -1.f;
+        front.emplace(0.f, seed, seed);
+        while (! front.empty()) {
+            const int id = std::get<1>(front.top()), from = std::get<2>(front.top());
+            front.pop();
+            if (visited[id]) continue;
+            visited[id] = 1;
+            auto n = m_points[id].tail<3>();
+            if (n.dot(m_points[from].tail<3>()) < 0) n *= -1.f;
+            for (int j : m_tree.k_nearest_neighbors(id, k))
+                if (! visited[j])
+                    front.emplace(1.f - std::abs(n.dot(m_points[j].tail<3>())), j, id);
+        }
+    }
+    // normals are part of the indexed points: the tree does not need to be rebuilt
+}
+
+void
+PointCloud3::computeNormals(int k) {
+    using ConstWeightFunc3 = Ponca::DistWeightFunc<DataPoint3,Ponca::ConstantWeightKernel<typename DataPoint3::Scalar> >;
+    using ConstPlaneFit3 = Ponca::Basket<DataPoint3 ,ConstWeightFunc3, Ponca::CovariancePlaneFit>;
+
+    std::cout << "Recompute normals" << std::endl;
+    const int nbPoints = int(m_points.size());
+#pragma omp parallel for schedule(dynamic, 1024) default(none) shared(nbPoints, k)
+    for (int i = 0; i < nbPoints; ++i) {
+        auto& pp = m_points[i];
+        const DataPoint3::VectorType p = pp.head<3>();
+        ConstPlaneFit3 fit;
+        fit.setWeightFunc({p});
+        fit.init();
+        if (fit.computeWithIds(m_tree.k_nearest_neighbors(p, k), m_tree.points()) == Ponca::STABLE)
+            pp.tail<3>() = fit.primitiveGradient().normalized();
+    }
+    // normals are part of the indexed points: the tree does not need to be rebuilt
+}
+
+void
+PointCloud3::setSlice(const SlicePlane& plane, float radius) {
+    if (plane == m_slice && radius == m_slabRadius) return;
+    m_slice = plane;
+    m_slabRadius = radius;
+    m_slab.clear();
+
+    if (m_tree.node_count() != 0) {
+        const DataPoint3::VectorType n = plane.normal();
+        const DataPoint3::VectorType absN = n.cwiseAbs();
+        auto addPoint = [this](typename KdTree3::IndexType id) { m_slab.push_back(m_points[id]); };
+
+        // same traversal as #processPointsInBox, with the slab as region
+        std::vector<std::pair<typename KdTree3::NodeIndexType, bool>> stack {{0, false}}; // node id, is inside slab
+        while (! stack.empty()) {
+            const auto [id, inside] = stack.back();
+            stack.pop_back();
+            const auto& node = m_tree.nodes()[id];
+            if (node.is_leaf()) {
+                const auto end = node.leaf_start() + node.leaf_size();
+                for (auto i = node.leaf_start(); i < end; ++i) {
+                    const auto pid = m_tree.samples()[i];
+                    if (inside || std::abs(n.dot(m_tree.points()[pid].pos() - plane.origin)) <= radius)
+                        addPoint(pid);
+                }
+            } else {
+                bool childInside = inside;
+                if (! inside) {
+                    const auto aabb = *node.getAabb();
+                    // distance of the box center to the plane, and half extent of the box along the normal
+                    const float d = std::abs(n.dot(aabb.center() - plane.origin));
+                    const float e = 0.5f * absN.dot(aabb.sizes());
+                    if (d - e > radius) continue;
+                    childInside = d + e <= radius;
+                }
+                stack.emplace_back(node.inner_first_child_id(), childInside);
+                stack.emplace_back(node.inner_first_child_id() + 1, childInside);
+            }
+        }
+    }
+
+    if (m_slab.empty()) m_slabTree.clear();
+    else m_slabTree.build(m_slab);
+}
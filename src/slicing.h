@@ -0,0 +1,222 @@
+#pragma once
+
+#include "contexts.h"
+#include "drawingPass.h" // FitParameters, ColorMap, post-processing policies
+#include "drawingPassRegistry.h"
+#include "fieldBuffer.h"
+#include "poncaTypes.h"
+#include "tileScheduler.h"
+
+#include <Ponca/Fitting>
+#include <Ponca/SpatialPartitioning>
+
+#include <cmath>
+#include <string>
+#include <type_traits>
+#include <utility> //pair
+#include <vector>
+
+/// 3D point attributes: x, y, z, nx, ny, nz, with unit normals
+using PointRecord3 = Eigen::Matrix<float, 6, 1>;
+
+/// Ponca point type for 3D clouds: lightweight view on a #PointRecord3, see #DataPoint
+class DataPoint3
+{
+public:
+    enum {Dim = 3};
+    using Scalar = float;
+    using VectorType = Eigen::Vector<Scalar,Dim>;
+    using MatrixType = Eigen::Matrix<Scalar,Dim,Dim>;
+    [[nodiscard]] inline Eigen::Map<const VectorType> pos() const {return Eigen::Map<const VectorType>(m_data);}
+    [[nodiscard]] inline Eigen::Map<const VectorType> normal() const {return Eigen::Map<const VectorType>(m_data + Dim);}
+    explicit inline DataPoint3(const PointRecord3 &pn) : m_data(pn.data()) {}
+private:
+    const Scalar* m_data {nullptr};
+};
+
+using WeightFunc3 = Ponca::DistWeightFunc<DataPoint3,Ponca::SmoothWeightKernel<typename DataPoint3::Scalar> >;
+
+using PlaneFit3            = Ponca::Basket<DataPoint3 ,WeightFunc3, Ponca::CovariancePlaneFit>;
+using SphereFit3           = Ponca::Basket<DataPoint3 ,WeightFunc3, Ponca::SphereFit>;
+using OrientedSphereFit3   = Ponca::Basket<DataPoint3 ,WeightFunc3, Ponca::OrientedSphereFit>;
+using UnorientedSphereFit3 = Ponca::Basket<DataPoint3 ,WeightFunc3, Ponca::UnorientedSphereFit>;
+
+/// 3D kd-tree, storing the bounding boxes of its inner nodes only (used to extract slabs)
+using KdTree3 = Ponca::KdTreeDenseBase<Ponca::KdTreeDefaultTraits<DataPoint3,MyKdTreeAabbNode>>;
+
+/// Plane mapped onto the image: pixel coordinates (x,y), in point units (see RenderingContext::pixToPoint), are
+/// located at origin + x u + y v
+struct SlicePlane {
+    using VectorType = DataPoint3::VectorType;
+    VectorType origin {VectorType::Zero()};
+    VectorType u {VectorType::UnitX()}; ///< unit vector
+    VectorType v {VectorType::UnitY()}; ///< unit vector, orthogonal to u
+
+    /// Build a plane from arbitrary axes: u is normalized, and v orthogonalized against u
+    static inline SlicePlane fromAxes(const VectorType& origin, const VectorType& u, const VectorType& v) {
+        SlicePlane p;
+        p.origin = origin;
+        p.u = u.normalized();
+        p.v = (v - v.dot(p.u) * p.u).normalized();
+        return p;
+    }
+
+    [[nodiscard]] inline VectorType normal() const { return u.cross(v); }
+    [[nodiscard]] inline VectorType toWorld(float x, float y) const { return origin + x * u + y * v; }
+    /// Same plane, moved by d along its normal
+    [[nodiscard]] inline SlicePlane offset(float d) const { SlicePlane p = *this; p.origin += d * normal(); return p; }
+    [[nodiscard]] inline bool operator==(const SlicePlane& o) const
+    { return origin == o.origin && u == o.u && v == o.v; }
+};
+
+/// 3D point cloud rendered through slicing planes
+///
+/// Fits evaluated on a slice only use points closer to the plane than the fitting scale: this slab is extracted once
+/// per slice (skipping the subtrees of the cloud kd-tree that are away from the plane) and indexed by its own small
+/// kd-tree, so per-pixel range queries never touch the rest of the cloud.
+class PointCloud3 {
+public:
+    using PointContainer = std::vector<PointRecord3>;
+
+    /// Load a cloud from
+    ///   - a text file, with one point per line: `x y z` or `x y z nx ny nz` (normals are estimated and oriented if
+    ///     missing, see #orientNormals)
+    ///   - a binary file (.bin): raw little-endian float32 records `x y z nx ny nz`
+    bool load(const std::string& path);
+
+    /// Scale and translate the points, so that their bounding box is centered on the origin and its largest side is
+    /// size long
+    void fitToSize(float size);
+
+    /// Bounding box of the points
+    [[nodiscard]] inline typename KdTree3::NodeType::AabbType boundingBox() const {
+        typename KdTree3::NodeType::AabbType box;
+        for (const auto& p : m_points) box.extend(p.head<3>());
+        return box;
+    }
+
+    [[nodiscard]] inline const PointContainer& points() const { return m_points; }
+    [[nodiscard]] inline const KdTree3& tree() const { return m_tree; }
+
+    /// Extract the points closer than radius to the plane, and index them. Does nothing if the slab is unchanged
+    void setSlice(const SlicePlane& plane, float radius);
+
+    [[nodiscard]] inline const SlicePlane& slice() const { return m_slice; }
+    [[nodiscard]] inline float slabRadius() const { return m_slabRadius; }
+    /// Index on the points of the current slab, see #setSlice
+    [[nodiscard]] inline const KdTree3& slabTree() const { return m_slabTree; }
+    [[nodiscard]] inline size_t slabSize() const { return m_slab.size(); }
+
+private:
+    void computeNormals(int k = 10);
+    /// Orient the estimated normals consistently, by propagating the orientation between neighbors with the most
+    /// parallel normals first (minimum spanning tree of the k-nearest neighbor graph). The orientation of each connected
+    /// component starts from its highest point, whose normal is pointed upward (+z).
+    void orientNormals(int k = 10);
+    /// Rebuild the kd-tree and force the extraction of the next slab
+    void updateIndex();
+
+    PointContainer m_points;
+    KdTree3 m_tree;
+
+    SlicePlane m_slice;
+    float m_slabRadius {-1.f};
+    PointContainer m_slab;  ///< copy of the points of the current slab
+    KdTree3 m_slabTree;
+};
+
+namespace internal {
+    /// Same fit as FitType, on 3D points: the basket extensions and the weight kernel are kept. 3D points are not
+    /// weighted (see #PointWeightFunc)
+    template <typename FitType>
+    struct Fit3;
+    template <typename P, typename Kernel, template <class, class, typename> class Ext0,
+              template <class, class, typename> class... Exts>
+    struct Fit3<Ponca::Basket<P, PointWeightFunc<P, Kernel>, Ext0, Exts...>> {
+        using type = Ponca::Basket<DataPoint3, Ponca::DistWeightFunc<DataPoint3, Kernel>, Ext0, Exts...>;
+    };
+}
+
+/// Render a MLS pass of the registry (see #IsFitField) on the current slice of cloud, as the pass does on 2D clouds
+///
+/// The pass fit is evaluated on 3D points, with the same extensions, weight kernel, post-processing and parameters.
+/// Output follows the #ColorMap conventions, and ctx.fields is filled if set (gradients are in world coordinates).
+/// Pixels are distributed by #forEachPixelWithCost, the cost of the tiles being counted on the slab: the slab must
+/// have been extracted with a radius not smaller than the scale of the pass. Queries moved by the MLS iterations
+/// away from the plane, whose ball leaves the slab, use the whole cloud.
+template <typename Pass>
+inline void renderSlice(const PointCloud3& cloud, const Pass& pass, float* buffer, RenderingContext ctx) {
+    using FitType    = typename internal::Fit3<typename Pass::FitType>::type;
+    using VectorType = DataPoint3::VectorType;
+    using AabbType   = typename KdTree3::NodeType::AabbType;
+    const auto& params = pass.params;
+    const auto& slab   = cloud.slabTree();
+    const auto& plane  = cloud.slice();
+    const VectorType n = plane.normal();
+    auto *fields = ctx.fields;
+
+    const auto tileCost = [&slab, &plane, &params](std::pair<float, float> lo, std::pair<float, float> hi) {
+        if (slab.node_count() == 0) return size_t(0);
+        AabbType box;
+        for (float x : {lo.first, hi.first})
+            for (float y : {lo.second, hi.second})
+                box.extend(plane.toWorld(x, y));
+        box.min().array() -= params.m_scale;
+        box.max().array() += params.m_scale;
+        size_t count = 0;
+        processPointsInBox(slab, box, [&count](int) { ++count; });
+        return count;
+    };
+
+    forEachPixelWithCost(ctx, tileCost, [&](int i, int j) {
+        auto *b = buffer + (i + j * ctx.w) * 4;
+        const auto coord = ctx.pixToPoint(i,j);
+        const VectorType x = plane.toWorld(coord.first, coord.second);
+        VectorType query = x;
+
+        FitType fit;
+        fit.setWeightFunc({query, params.m_scale});
+        for (int iter = 0; iter != params.m_iter; ++iter) {
+            fit.init();
+            const bool inSlab = std::abs(n.dot(query - plane.origin)) + params.m_scale <= cloud.slabRadius();
+            const auto& index = inSlab ? slab : cloud.tree();
+            if (fit.computeWithIds(index.range_neighbors(query, params.m_scale), index.points()) == Ponca::STABLE)
+                query = fit.project(query);
+        }
+
+        if ( fit.isStable() ){
+            Pass::PostProcess::apply(fit);
+            float dist = fit.potential(x);
+
+            b[0] = fit.isSigned() ? dist : std::abs(dist);
+            b[2] = ColorMap::VALUE_IS_VALID;
+            b[3] = ColorMap::SCALAR_FIELD;
+        }
+        else{
+            b[2] = ColorMap::VALUE_IS_INVALID;
+        }
+        if (fields) fields->write(i + j * ctx.w, fit, x);
+    }, [buffer, &ctx, fields](int i, int j) {
+        // no point of the slab closer than the scale: the fit is not defined
+        buffer[(i + j * ctx.w) * 4 + 2] = ColorMap::VALUE_IS_INVALID;
+        if (fields) fields->writeUncovered(i + j * ctx.w, float(Ponca::UNDEFINED));
+    });
+    if (fields) fields->setWritten();
+    // store data for colormap processing (see #ColorMap)
+    buffer[1] = params.m_scale;
+    buffer[3] = ColorMap::SCALAR_FIELD;
+}
+
+/// Check if a pass of the registry can be rendered on slices, see #renderSlice
+inline constexpr bool supportsSlicing(size_t passId) { return DrawingPassRegistry::satisfies<IsFitField>(passId); }
+
+/// Render a pass of the registry on the current slice of cloud, see #renderSlice
+/// \return false if the pass cannot be rendered on slices (see #supportsSlicing)
+inline bool renderSlice(size_t passId, DrawingPass* pass, const PointCloud3& cloud, float* buffer,
+                        RenderingContext ctx) {
+    if (! supportsSlicing(passId)) return false;
+    return DrawingPassRegistry::visit(passId, pass, [&](auto* p) {
+        if constexpr (IsFitField<std::remove_pointer_t<decltype(p)>>::value)
+            renderSlice(cloud, *p, buffer, ctx);
+    });
+}
@@ -0,0 +1,53 @@
+#include "syntheticCloud.h"
+
+#include <cmath>
+#include <random>
+
+namespace poncaplot {
+    std::vector<PointRecord> generateCloud(SyntheticShape shape, size_t count, unsigned int seed) {
+        constexpr float center = 250.f;
+        constexpr float pi = 3.14159265358979f;
+        std::mt19937 gen (seed);
+        std::vector<PointRecord> points;
+        points.reserve(count);
+
+        switch (shape) {
+            case SyntheticShape::CIRCLE: {
+                constexpr float radius = 150.f;
+                for (size_t k = 0; k != count; ++k) {
+                    const float a = 2.f * pi * float(k) / float(count);
+                    points.emplace_back(center + radius * std::cos(a), center + radius * std::sin(a),
+                                        std::cos(a), std::sin(a));
+                }
+                break;
+            }
+            case SyntheticShape::LINE: {
+                std::uniform_real_distribution<float> x (50.f, 450.f);
+                std::normal_distribution<float> noise (0.f, 0.5f);
+                std::normal_distribution<float> tilt (0.f, 0.05f);
+                for (size_t k = 0; k != count; ++k) {
+                    const float a = pi / 2.f + tilt(gen);
+                    points.emplace_back(x(gen), center + noise(gen), std::cos(a), std::sin(a));
+                }
+                break;
+            }
+            case SyntheticShape::CLUSTERS: {
+                // y = center + amplitude * sin(x / period), sampled around a few x with growing spreads
+                constexpr float amplitude = 80.f, period = 60.f;
+                constexpr std::array<float, 4> clusterX {100.f, 200.f, 300.f, 400.f};
+                constexpr std::array<float, 4> clusterSpread {2.f, 8.f, 20.f, 50.f};
+                std::uniform_int_distribution<size_t> cluster (0, clusterX.size() - 1);
+                std::normal_distribution<float> offset (0.f, 1.f);
+                for (size_t k = 0; k != count; ++k) {
+                    const size_t c = cluster(gen);
+                    const float x = clusterX[c] + clusterSpread[c] * offset(gen);
+                    const float dy = amplitude / period * std::cos(x / period); // slope of the curve
+                    const float norm = std::sqrt(1.f + dy * dy);
+                    points.emplace_back(x, center + amplitude * std::sin(x / period), -dy / norm, 1.f / norm);
+                }
+                break;
+            }
+        }
+        return points;
+    }
+}
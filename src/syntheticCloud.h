@@ -0,0 +1,20 @@
+#pragma once
+
+#include "poncaTypes.h"
+
+#include <array>
+#include <string_view>
+#include <vector>
+
+namespace poncaplot {
+    /// Shapes of #generateCloud
+    enum class SyntheticShape: int {
+        CIRCLE,  ///< uniformly sampled circle, exact normals
+        LINE,    ///< horizontal line with noisy positions and normals
+        CLUSTERS ///< sine curve sampled around a few clusters: the density varies by orders of magnitude
+    };
+    constexpr std::array<std::string_view, 3> syntheticShapeNames {"circle", "line", "clusters"};
+
+    /// Generate a point cloud (x, y, nx, ny) fitting a 500x500 image, reproducible for a given seed
+    std::vector<PointRecord> generateCloud(SyntheticShape shape, size_t count, unsigned int seed = 42);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "contexts.h"
+#include "poncaTypes.h"
+
+#include <algorithm> // min, stable_sort
+#include <numeric>   // iota
+#include <utility>   // pair
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/// Set the number of threads used by the parallel loops started from the calling thread (e.g. the drawing passes)
+/// \param n number of threads, 0 to use all the cores
+inline void setRenderThreadCount(int n) {
+#ifdef _OPENMP
+    omp_set_num_threads(n > 0 ? n : omp_get_num_procs());
+#endif
+}
+
+/// Call f(i,j) for each pixel of the image, in parallel, by square tiles distributed according to ctx.schedule
+///
+/// The cost of a pixel grows with the number of points used by its fit: pixels far from the cloud are almost free,
+/// while pixels in dense regions may fit hundreds of neighbors. tileCost(lo, hi) estimates the cost of the tile whose
+/// corners are lo and hi (in point coordinates, see RenderingContext::pixToPoint), as the number of points whose
+/// neighborhood may reach its pixels. With RenderingContext::COST_AWARE, the most expensive tiles are processed first,
+/// so that the cheap ones fill the idle threads at the end.
+///
+/// Tiles of null cost are not covered by any neighborhood: for their pixels, uncovered(i,j) is called instead of
+/// f(i,j), so that they can be marked invalid without querying the spatial index.
+template <typename TileCost, typename Functor, typename UncoveredFunctor>
+inline void forEachPixelWithCost(const RenderingContext& ctx, TileCost tileCost, Functor f,
+                                 UncoveredFunctor uncovered) {
+    constexpr int tileSize = 32;
+    const int w = int(ctx.w);
+    const int h = int(ctx.h);
+    const int nbTilesX = (w + tileSize - 1) / tileSize;
+    const int nbTiles  = nbTilesX * ((h + tileSize - 1) / tileSize);
+
+    std::vector<int> order (nbTiles);
+    std::iota(order.begin(), order.end(), 0);
+
+    std::vector<size_t> cost (nbTiles);
+#pragma omp parallel for default(none) shared(tileCost, ctx, cost, nbTiles, nbTilesX, w, h)
+    for (int t = 0; t < nbTiles; ++t) {
+        const int i0 = (t % nbTilesX) * tileSize, j0 = (t / nbTilesX) * tileSize;
+        cost[t] = tileCost(ctx.pixToPoint(i0, j0),
+                           ctx.pixToPoint(std::min(i0 + tileSize, w), std::min(j0 + tileSize, h)));
+    }
+    if (ctx.schedule == RenderingContext::COST_AWARE)
+        std::stable_sort(order.begin(), order.end(), [&cost](int a, int b) { return cost[a] > cost[b]; });
+
+    auto processTile = [&f, &uncovered, &cost, nbTilesX, w, h](int t) {
+        const int i0 = (t % nbTilesX) * tileSize, j0 = (t / nbTilesX) * tileSize;
+        const int i1 = std::min(i0 + tileSize, w), j1 = std::min(j0 + tileSize, h);
+        if (cost[t] == 0) {
+            for (int j = j0; j < j1; ++j)
+                for (int i = i0; i < i1; ++i)
+                    uncovered(i, j);
+        } else {
+            for (int j = j0; j < j1; ++j)
+                for (int i = i0; i < i1; ++i)
+                    f(i, j);
+        }
+    };
+
+    if (ctx.schedule == RenderingContext::STATIC) {
+#pragma omp parallel for schedule(static) default(none) shared(order, nbTiles, processTile)
+        for (int k = 0; k < nbTiles; ++k)
+            processTile(order[k]);
+    } else {
+#pragma omp parallel for schedule(dynamic, 1) default(none) shared(order, nbTiles, processTile)
+        for (int k = 0; k < nbTiles; ++k)
+            processTile(order[k]);
+    }
+}
+
+/// #forEachPixelWithCost on a 2D cloud: the cost of each tile is the number of points of its bounding box extended by
+/// radius (using the kd-tree node counts)
+template <typename Functor, typename UncoveredFunctor>
+inline void forEachPixel(const KdTree& tree, const RenderingContext& ctx, float radius, Functor f,
+                         UncoveredFunctor uncovered) {
+    using AabbType = typename KdTree::NodeType::AabbType;
+    const bool empty = tree.node_count() == 0; // no estimate: all the tiles are covered
+    forEachPixelWithCost(ctx, [&tree, radius, empty](std::pair<float, float> lo, std::pair<float, float> hi) {
+        if (empty) return size_t(1);
+        const AabbType box (DataPoint::VectorType(lo.first - radius, lo.second - radius),
+                            DataPoint::VectorType(hi.first + radius, hi.second + radius));
+        return countPointsInBox(tree, box);
+    }, f, uncovered);
+}
+
+/// Same as above, calling f for all the pixels
+template <typename Functor>
+inline void forEachPixel(const KdTree& tree, const RenderingContext& ctx, float radius, Functor f) {
+    forEachPixel(tree, ctx, radius, f, f);
+}
@@ -0,0 +1,285 @@
+#include "tiledStore.h"
+
+#include <algorithm> // max, min
+#include <cmath>     // floor
+#include <cstdio>    // remove
+#include <cstring>   // memcpy
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PONCAPLOT_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    constexpr char magic[8] = {'P', 'P', 'T', 'I', 'L', 'E', 'S', '1'};
+    constexpr size_t headerSize = 48; // 36 bytes used, padded to keep the points 16-byte aligned
+
+    struct Header {
+        std::uint32_t nbTilesX, nbTilesY;
+        float originX, originY, tileSize;
+        std::uint64_t nbPoints;
+    };
+
+    /// Parse a line of a point cloud text file, see DataManager::loadPointCloud
+    bool parsePoint(std::string& line, std::vector<float>& numbers, PointRecord& p) {
+        std::size_t found = line.find('#');
+        if (found != std::string::npos) line.resize(found);
+        if (line.empty()) return false;
+        numbers.clear();
+        std::istringstream is(line);
+        numbers.assign(std::istream_iterator<float>(is), std::istream_iterator<float>());
+        if (numbers.size() == 2)
+            p = PointRecord(numbers[0], numbers[1], 0.f, 1.f); // same as DEFAULT_POINT_ANGLE
+        else if (numbers.size() == 4) {
+            p = PointRecord(numbers[0], numbers[1], numbers[2], numbers[3]);
+            p.tail<2>().normalize();
+        } else {
+            std::cerr << "Skipping malformed line: [" << line << "]" << std::endl;
+            return false;
+        }
+        return true;
+    }
+}
+
+TiledPointStore::~TiledPointStore() { close(); }
+
+bool
+TiledPointStore::build(const std::string& inputPath, const std::string& outputPath, float tileSize) {
+    if (tileSize <= 0) return false;
+    std::ifstream in(inputPath);
+    if (!in.is_open()) return false;
+
+    // 1. convert to binary once, and compute the bounds
+    const std::string tmpPath = outputPath + ".tmp";
+    std::uint64_t nbPoints = 0;
+    float minX = std::numeric_limits<float>::max(), minY = minX;
+    float maxX = std::numeric_limits<float>::lowest(), maxY = maxX;
+    {
+        std::ofstream tmp(tmpPath, std::ios::binary);
+        if (!tmp.is_open()) return false;
+        std::string line;
+        std::vector<float> numbers;
+        PointRecord p;
+        while (std::getline(in, line)) {
+            if (!parsePoint(line, numbers, p)) continue;
+            minX = std::min(minX, p.x()); maxX = std::max(maxX, p.x());
+            minY = std::min(minY, p.y()); maxY = std::max(maxY, p.y());
+            tmp.write(reinterpret_cast<const char*>(p.data()), sizeof(PointRecord));
+            ++nbPoints;
+        }
+        if (!tmp) return false;
+    }
+    if (nbPoints == 0) { std::remove(tmpPath.c_str()); return false; }
+
+    Header header {};
+    header.nbTilesX = std::uint32_t(std::floor((maxX - minX) / tileSize)) + 1;
+    header.nbTilesY = std::uint32_t(std::floor((maxY - minY) / tileSize)) + 1;
+    header.originX = minX;
+    header.originY = minY;
+    header.tileSize = tileSize;
+    header.nbPoints = nbPoints;
+    const size_t nbTiles = size_t(header.nbTilesX) * header.nbTilesY;
+    auto tileOf = [&header](const PointRecord& p) {
+        const auto i = std::min(header.nbTilesX - 1, std::uint32_t((p.x() - header.originX) / header.tileSize));
+        const auto j = std::min(header.nbTilesY - 1, std::uint32_t((p.y() - header.originY) / header.tileSize));
+        return size_t(i) + size_t(j) * header.nbTilesX;
+    };
+
+    // read the binary copy by blocks
+    constexpr size_t blockSize = 1 << 16;
+    std::vector<PointRecord> block (blockSize);
+    auto forEachBlock = [&](auto f) {
+        std::ifstream tmp(tmpPath, std::ios::binary);
+        for (std::uint64_t done = 0; done < nbPoints; ) {
+            const size_t n = size_t(std::min<std::uint64_t>(blockSize, nbPoints - done));
+            tmp.read(reinterpret_cast<char*>(block.data()), std::streamsize(n * sizeof(PointRecord)));
+            f(n);
+            done += n;
+        }
+    };
+
+    // 2. count the points of each tile, to build the directory
+    std::vector<TileEntry> directory (nbTiles, TileEntry{0, 0});
+    forEachBlock([&](size_t n) { for (size_t k = 0; k != n; ++k) ++directory[tileOf(block[k])].count; });
+    for (size_t t = 1; t < nbTiles; ++t)
+        directory[t].first = directory[t - 1].first + directory[t - 1].count;
+
+    // 3. write the points at their position, through small per-tile buffers
+    std::fstream out(outputPath, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) { std::remove(tmpPath.c_str()); return false; }
+    char headerBytes[headerSize] {};
+    std::memcpy(headerBytes, magic, sizeof(magic));
+    std::memcpy(headerBytes + 8, &header.nbTilesX, 4);
+    std::memcpy(headerBytes + 12, &header.nbTilesY, 4);
+    std::memcpy(headerBytes + 16, &header.originX, 4);
+    std::memcpy(headerBytes + 20, &header.originY, 4);
+    std::memcpy(headerBytes + 24, &header.tileSize, 4);
+    std::memcpy(headerBytes + 28, &header.nbPoints, 8);
+    out.write(headerBytes, headerSize);
+    out.write(reinterpret_cast<const char*>(directory.data()), std::streamsize(nbTiles * sizeof(TileEntry)));
+    const std::uint64_t dataOffset = headerSize + nbTiles * sizeof(TileEntry);
+
+    constexpr size_t pendingSize = 256;
+    std::vector<std::vector<PointRecord>> pending (nbTiles);
+    std::vector<std::uint64_t> written (nbTiles, 0);
+    auto flush = [&](size_t t) {
+        out.seekp(std::streamoff(dataOffset + (directory[t].first + written[t]) * sizeof(PointRecord)));
+        out.write(reinterpret_cast<const char*>(pending[t].data()),
+                  std::streamsize(pending[t].size() * sizeof(PointRecord)));
+        written[t] += pending[t].size();
+        pending[t].clear();
+    };
+    forEachBlock([&](size_t n) {
+        for (size_t k = 0; k != n; ++k) {
+            const size_t t = tileOf(block[k]);
+            pending[t].push_back(block[k]);
+            if (pending[t].size() == pendingSize) flush(t);
+        }
+    });
+    for (size_t t = 0; t != nbTiles; ++t)
+        if (!pending[t].empty()) flush(t);
+    const bool ok = bool(out);
+    out.close();
+    std::remove(tmpPath.c_str());
+
+    std::cout << "Bucketed " << nbPoints << " points in " << header.nbTilesX << "x" << header.nbTilesY << " tiles"
+              << std::endl;
+    return ok;
+}
+
+bool
+TiledPointStore::open(const std::string& path) {
+    close();
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+
+    char headerBytes[headerSize];
+    if (!in.read(headerBytes, headerSize) || std::memcmp(headerBytes, magic, sizeof(magic)) != 0) return false;
+    std::memcpy(&m_nbTilesX, headerBytes + 8, 4);
+    std::memcpy(&m_nbTilesY, headerBytes + 12, 4);
+    std::memcpy(&m_originX, headerBytes + 16, 4);
+    std::memcpy(&m_originY, headerBytes + 20, 4);
+    std::memcpy(&m_tileSize, headerBytes + 24, 4);
+    std::memcpy(&m_nbPoints, headerBytes + 28, 8);
+    m_directory.resize(size_t(m_nbTilesX) * m_nbTilesY);
+    if (!in.read(reinterpret_cast<char*>(m_directory.data()), std::streamsize(m_directory.size() * sizeof(TileEntry)))) {
+        close();
+        return false;
+    }
+    m_dataOffset = headerSize + m_directory.size() * sizeof(TileEntry);
+    m_path = path;
+
+#ifdef PONCAPLOT_HAS_MMAP
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st {};
+    if (fd >= 0 && ::fstat(fd, &st) == 0) {
+        void* mapping = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            m_mapping = static_cast<const char*>(mapping);
+            m_mappingSize = size_t(st.st_size);
+        }
+    }
+    if (fd >= 0) ::close(fd);
+#endif
+    return true;
+}
+
+void
+TiledPointStore::close() {
+    m_regionTree.clear();
+    m_regionPoints.clear();
+    m_resident.clear();
+    m_lru.clear();
+#ifdef PONCAPLOT_HAS_MMAP
+    if (m_mapping) ::munmap(const_cast<char*>(m_mapping), m_mappingSize);
+#endif
+    m_mapping = nullptr;
+    m_mappingSize = 0;
+    m_directory.clear();
+    m_nbTilesX = m_nbTilesY = 0;
+    m_nbPoints = 0;
+}
+
+const TiledPointStore::Tile&
+TiledPointStore::acquire(size_t tileId) {
+    auto it = m_resident.find(tileId);
+    if (it != m_resident.end()) {
+        m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+        return it->second;
+    }
+    Tile& tile = m_resident[tileId];
+    const auto& entry = m_directory[tileId];
+    if (m_mapping)
+        tile.points = reinterpret_cast<const PointRecord*>(m_mapping + m_dataOffset + entry.first * sizeof(PointRecord));
+    else {
+        std::ifstream in(m_path, std::ios::binary);
+        tile.owned.resize(entry.count);
+        in.seekg(std::streamoff(m_dataOffset + entry.first * sizeof(PointRecord)));
+        in.read(reinterpret_cast<char*>(tile.owned.data()), std::streamsize(entry.count * sizeof(PointRecord)));
+        tile.points = tile.owned.data();
+    }
+    m_lru.push_front(tileId);
+    tile.lru = m_lru.begin();
+    return tile;
+}
+
+void
+TiledPointStore::release(size_t tileId) {
+    auto it = m_resident.find(tileId);
+    if (it == m_resident.end()) return;
+#ifdef PONCAPLOT_HAS_MMAP
+    if (m_mapping && m_directory[tileId].count != 0) {
+        // give the pages back to the system: they are read again from the file if the tile is used later
+        static const auto pageSize = size_t(::sysconf(_SC_PAGESIZE));
+        const size_t begin = m_dataOffset + m_directory[tileId].first * sizeof(PointRecord);
+        const size_t end = begin + m_directory[tileId].count * sizeof(PointRecord);
+        const size_t alignedBegin = begin / pageSize * pageSize;
+        ::madvise(const_cast<char*>(m_mapping) + alignedBegin, end - alignedBegin, MADV_DONTNEED);
+    }
+#endif
+    m_lru.erase(it->second.lru);
+    m_resident.erase(it);
+}
+
+const TiledPointStore::IndexedTree&
+TiledPointStore::region(const AabbType& box) {
+    m_regionPoints.clear();
+    if (isOpen() && !box.isEmpty()) {
+        auto clampTile = [](float v, std::uint32_t n) {
+            return std::uint32_t(std::clamp(std::floor(v), 0.f, float(n - 1)));
+        };
+        const auto i0 = clampTile((box.min().x() - m_originX) / m_tileSize, m_nbTilesX);
+        const auto i1 = clampTile((box.max().x() - m_originX) / m_tileSize, m_nbTilesX);
+        const auto j0 = clampTile((box.min().y() - m_originY) / m_tileSize, m_nbTilesY);
+        const auto j1 = clampTile((box.max().y() - m_originY) / m_tileSize, m_nbTilesY);
+
+        size_t nbTiles = 0;
+        for (auto j = j0; j <= j1; ++j)
+            for (auto i = i0; i <= i1; ++i) {
+                const size_t id = size_t(i) + size_t(j) * m_nbTilesX;
+                const auto count = m_directory[id].count;
+                if (count == 0) continue;
+                const Tile& tile = acquire(id);
+                ++nbTiles;
+                for (std::uint64_t k = 0; k != count; ++k)
+                    if (box.contains(tile.points[k].head<2>()))
+                        m_regionPoints.emplace_back(tile.points[k]);
+            }
+
+        // the tiles of this region are at the front of the list
+        while (m_lru.size() > std::max(m_maxResidentTiles, nbTiles))
+            release(m_lru.back());
+    }
+
+    if (m_regionPoints.empty()) m_regionTree.clear();
+    else m_regionTree.build(m_regionPoints);
+    return m_regionTree;
+}
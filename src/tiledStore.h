@@ -0,0 +1,81 @@
+#pragma once
+
+#include "poncaTypes.h"
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// Out-of-core point cloud, bucketed on disk by square tiles
+///
+/// File layout (little-endian):
+///   - header: magic "PPTILES1", uint32 number of tiles along x and y, float32 origin x, origin y and tile size,
+///     uint64 number of points, padded to 16 bytes
+///   - directory: for each tile (row-major), uint64 index of its first point and uint64 number of points
+///   - points: #PointRecord (x, y, nx, ny float32), grouped by tile
+///
+/// The file is memory-mapped when the platform allows it: a region is rendered by indexing in place the points of the
+/// tiles it overlaps, so memory grows with the region instead of the cloud. The tiles touched by the last regions
+/// are kept resident, up to a bound, and the others are released to the system (least recently used first).
+class TiledPointStore {
+public:
+    using IndexedTree = MyKdTreeDense<Ponca::KdTreeDefaultTraits<DataPoint,MyKdTreeNode>>;
+    using AabbType = typename IndexedTree::NodeType::AabbType;
+
+    TiledPointStore() = default;
+    TiledPointStore(const TiledPointStore&) = delete;
+    TiledPointStore& operator=(const TiledPointStore&) = delete;
+    ~TiledPointStore();
+
+    /// Bucket a text point cloud (as read by DataManager::loadPointCloud) into a tile file, streaming the points
+    /// \param tileSize side of the tiles, in point units
+    static bool build(const std::string& inputPath, const std::string& outputPath, float tileSize);
+
+    /// Open a tile file built by #build
+    bool open(const std::string& path);
+    void close();
+
+    [[nodiscard]] inline bool isOpen() const { return m_nbTilesX != 0; }
+    [[nodiscard]] inline std::uint64_t pointCount() const { return m_nbPoints; }
+
+    /// Maximum number of tiles kept resident between two calls to #region (at least the tiles of the last region)
+    inline void setMaxResidentTiles(size_t n) { m_maxResidentTiles = n; }
+
+    /// Index the points of the tiles overlapping box
+    /// \return a kd-tree on these points, valid until the next call
+    const IndexedTree& region(const AabbType& box);
+
+private:
+    struct TileEntry {
+        std::uint64_t first;
+        std::uint64_t count;
+    };
+    /// Points of a resident tile
+    struct Tile {
+        const PointRecord* points {nullptr};
+        std::vector<PointRecord> owned;  ///< storage when the file is not memory-mapped
+        std::list<size_t>::iterator lru; ///< position in m_lru
+    };
+
+    const Tile& acquire(size_t tileId);
+    void release(size_t tileId);
+
+    std::string m_path;
+    std::uint32_t m_nbTilesX {0}, m_nbTilesY {0};
+    float m_originX {0}, m_originY {0}, m_tileSize {1};
+    std::uint64_t m_nbPoints {0};
+    std::uint64_t m_dataOffset {0}; ///< position of the first point in the file, in bytes
+    std::vector<TileEntry> m_directory;
+
+    const char* m_mapping {nullptr}; ///< whole file, nullptr if not memory-mapped
+    size_t m_mappingSize {0};
+
+    std::unordered_map<size_t, Tile> m_resident;
+    std::list<size_t> m_lru;         ///< resident tiles, most recently used first
+    size_t m_maxResidentTiles {64};
+
+    std::vector<DataPoint> m_regionPoints;
+    IndexedTree m_regionTree;
+};
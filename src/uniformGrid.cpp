@@ -0,0 +1,105 @@
+#include "uniformGrid.h"
+
+#include <algorithm> // max, min
+#include <cmath>     // ceil, floor, sqrt
+#include <cstdint>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+void
+UniformGrid::clear() {
+    m_points.clear();
+    m_ids.clear();
+    m_cellStart.assign(1, 0);
+    m_nx = m_ny = 0;
+}
+
+void
+UniformGrid::build(const PointContainer& points, Scalar cellSize) {
+    if (points.empty()) { clear(); return; }
+
+    const int n = int(points.size());
+
+    // bounding box
+    Eigen::AlignedBox<Scalar, DataPoint::Dim> aabb;
+    for (const auto& p : points) aabb.extend(p.pos());
+
+    // bound the number of cells to keep memory and scan cost proportional to the number of points
+    const VectorType extent = aabb.diagonal();
+    const auto maxCells = Scalar(std::max(1024, 4 * n));
+    m_cellSize = std::max({cellSize, std::sqrt(extent.prod() / maxCells), extent.maxCoeff() / maxCells, Scalar(1e-6)});
+    m_origin = aabb.min();
+    m_nx = int(std::floor(extent.x() / m_cellSize)) + 1;
+    m_ny = int(std::floor(extent.y() / m_cellSize)) + 1;
+    const int nbCells = m_nx * m_ny;
+
+    // counting sort, split in chunks to be parallel and stable
+#ifdef _OPENMP
+    const int nbChunks = std::min(omp_get_max_threads(), std::max(1, n / 4096));
+#else
+    const int nbChunks = 1;
+#endif
+    // first point of each chunk, in 64 bits: n * c overflows int on large clouds
+    std::vector<int> chunkStart (nbChunks + 1);
+    for (int c = 0; c <= nbChunks; ++c) chunkStart[c] = int(std::int64_t(n) * c / nbChunks);
+    std::vector<IndexType> cellIds (n);
+    std::vector<IndexType> counts (size_t(nbChunks) * nbCells, 0);
+    const VectorType origin = m_origin;
+    const Scalar invCellSize = Scalar(1) / m_cellSize;
+    const int nx = m_nx, ny = m_ny;
+
+#pragma omp parallel for default(none) shared(points, cellIds, counts, chunkStart, nbChunks, nbCells, origin, invCellSize, nx, ny)
+    for (int c = 0; c < nbChunks; ++c) {
+        auto* chunkCount = counts.data() + size_t(c) * nbCells;
+        for (int i = chunkStart[c]; i < chunkStart[c + 1]; ++i) {
+            const VectorType local = (points[i].pos() - origin) * invCellSize;
+            const int cx = std::min(int(local.x()), nx - 1);
+            const int cy = std::min(int(local.y()), ny - 1);
+            cellIds[i] = cy * nx + cx;
+            ++chunkCount[cellIds[i]];
+        }
+    }
+
+    // exclusive scan, cell-major then chunk-major: counts now stores the write offset of each chunk in each cell
+    m_cellStart.resize(nbCells + 1);
+    IndexType offset = 0;
+    for (int cell = 0; cell < nbCells; ++cell) {
+        m_cellStart[cell] = offset;
+        for (int c = 0; c < nbChunks; ++c) {
+            auto& count = counts[size_t(c) * nbCells + cell];
+            const auto tmp = count;
+            count = offset;
+            offset += tmp;
+        }
+    }
+    m_cellStart[nbCells] = offset;
+
+    m_points.resize(n, points[0]);
+    m_ids.resize(n);
+    auto* sortedPoints = m_points.data();
+    auto* sortedIds = m_ids.data();
+#pragma omp parallel for default(none) shared(points, cellIds, counts, chunkStart, nbChunks, nbCells, sortedPoints, sortedIds)
+    for (int c = 0; c < nbChunks; ++c) {
+        auto* chunkOffset = counts.data() + size_t(c) * nbCells;
+        for (int i = chunkStart[c]; i < chunkStart[c + 1]; ++i) {
+            const auto dst = chunkOffset[cellIds[i]]++;
+            sortedPoints[dst] = points[i];
+            sortedIds[dst] = i;
+        }
+    }
+}
+
+void
+UniformGrid::cellRange(const VectorType& query, Scalar radius,
+                       int& colStart, int& colEnd, int& rowStart, int& rowEnd) const {
+    if (m_points.empty()) { colStart = rowStart = 0; colEnd = rowEnd = -1; return; }
+    const VectorType lo = (query - m_origin).array() - radius;
+    const VectorType hi = (query - m_origin).array() + radius;
+    colStart = std::max(0, int(std::floor(lo.x() / m_cellSize)));
+    rowStart = std::max(0, int(std::floor(lo.y() / m_cellSize)));
+    colEnd   = std::min(m_nx - 1, int(std::floor(hi.x() / m_cellSize)));
+    rowEnd   = std::min(m_ny - 1, int(std::floor(hi.y() / m_cellSize)));
+    if (colStart > colEnd) rowEnd = rowStart - 1; // empty
+}
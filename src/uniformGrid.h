@@ -0,0 +1,104 @@
+#pragma once
+
+#include "poncaTypes.h"
+
+#include <vector>
+
+/// Uniform grid (cell list) for fixed-radius range queries
+///
+/// Points are copied and sorted by cell (counting sort, O(N)), so that the points of one row of cells are contiguous
+/// in memory. Best performances are reached when the cell size matches the query radius, but any radius is supported.
+///
+/// Provides the subset of the kd-tree interface used by #FitField (points(), range_neighbors()), so that returned
+/// ranges can be used with `computeWithIds`. Indices refer to #points(), use #originalId to go back to the input order.
+class UniformGrid {
+public:
+    using Scalar         = typename DataPoint::Scalar;
+    using VectorType     = typename DataPoint::VectorType;
+    using PointContainer = std::vector<DataPoint>;
+    using IndexType      = int;
+
+    /// Range of the indices of the points located strictly inside a ball
+    class RangeQuery {
+    public:
+        class Iterator {
+        public:
+            inline IndexType operator*() const { return m_i; }
+            inline bool operator!=(const Iterator& o) const { return m_i != o.m_i; }
+            inline Iterator& operator++() { ++m_i; advance(); return *this; }
+        private:
+            friend class RangeQuery;
+            inline Iterator(const RangeQuery* q, int row, IndexType i, IndexType end)
+                    : m_q(q), m_row(row), m_i(i), m_end(end) {}
+            /// Move to the next point inside the ball, or to the end
+            inline void advance() {
+                while (true) {
+                    for (; m_i < m_end; ++m_i)
+                        if ((m_q->m_grid->m_points[m_i].pos() - m_q->m_query).squaredNorm() < m_q->m_sqRadius) return;
+                    if (++m_row > m_q->m_rowEnd) { m_i = -1; return; }
+                    m_q->rowRange(m_row, m_i, m_end);
+                }
+            }
+            const RangeQuery* m_q;
+            int m_row;
+            IndexType m_i, m_end;
+        };
+
+        inline Iterator begin() const {
+            if (m_rowStart > m_rowEnd) return end();
+            IndexType i, e;
+            rowRange(m_rowStart, i, e);
+            Iterator it (this, m_rowStart, i, e);
+            it.advance();
+            return it;
+        }
+        inline Iterator end() const { return {this, m_rowEnd, -1, -1}; }
+
+    private:
+        friend class UniformGrid;
+        inline RangeQuery(const UniformGrid* grid, const VectorType& query, Scalar radius)
+                : m_grid(grid), m_query(query), m_sqRadius(radius * radius) {
+            grid->cellRange(query, radius, m_colStart, m_colEnd, m_rowStart, m_rowEnd);
+        }
+        /// Cells of a row are contiguous: get the point range covered by the query on this row
+        inline void rowRange(int row, IndexType& start, IndexType& end) const {
+            start = m_grid->m_cellStart[row * m_grid->m_nx + m_colStart];
+            end   = m_grid->m_cellStart[row * m_grid->m_nx + m_colEnd + 1];
+        }
+
+        const UniformGrid* m_grid;
+        VectorType m_query;
+        Scalar m_sqRadius;
+        int m_colStart {0}, m_colEnd {-1}, m_rowStart {0}, m_rowEnd {-1};
+    };
+
+    /// Build the grid from a point collection
+    /// \param cellSize Requested cell size. Might be increased to bound the number of cells w.r.t. the number of points
+    void build(const PointContainer& points, Scalar cellSize);
+
+    void clear();
+
+    /// Range query, same semantic as Ponca::KdTreeBase::range_neighbors
+    [[nodiscard]] inline RangeQuery range_neighbors(const VectorType& query, Scalar radius) const
+    { return {this, query, radius}; }
+
+    /// Points sorted by cell
+    [[nodiscard]] inline const PointContainer& points() const { return m_points; }
+    [[nodiscard]] inline size_t point_count() const { return m_points.size(); }
+    /// Index of a point of #points() in the container used to build the grid
+    [[nodiscard]] inline IndexType originalId(IndexType i) const { return m_ids[i]; }
+
+    [[nodiscard]] inline Scalar cellSize() const { return m_cellSize; }
+    [[nodiscard]] inline int cellCount() const { return m_nx * m_ny; }
+
+private:
+    /// Range of cells (inclusive) overlapping the bounding box of a ball. Empty ranges have end < start
+    void cellRange(const VectorType& query, Scalar radius, int& colStart, int& colEnd, int& rowStart, int& rowEnd) const;
+
+    PointContainer m_points;
+    std::vector<IndexType> m_ids;
+    std::vector<IndexType> m_cellStart; ///< Offset of each cell in m_points, size cellCount()+1
+    VectorType m_origin {VectorType::Zero()};
+    Scalar m_cellSize {1};
+    int m_nx {0}, m_ny {0};
+};